@@ -1,10 +1,40 @@
 #include "sourceplugin.h"
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDebug>
 using namespace qpmx;
 
 SourcePlugin::SourcePlugin() = default;
 
 SourcePlugin::~SourcePlugin() = default;
 
+QList<QVersionNumber> SourcePlugin::findPackageVersions(const QList<PackageInfo> &packages)
+{
+	QList<QVersionNumber> versions;
+	versions.reserve(packages.size());
+	for(const auto &package : packages) {
+		try {
+			versions.append(findPackageVersion(package));
+		} catch(SourcePluginException &e) {
+			qWarning().noquote() << QCoreApplication::translate("qpmx::SourcePlugin", "Failed to find version of package %1 with error: %2")
+									.arg(package.toString(), e.qWhat());
+			versions.append(QVersionNumber{});
+		}
+	}
+	return versions;
+}
+
+void SourcePlugin::getPackageSources(const QList<QPair<PackageInfo, QDir>> &packages)
+{
+	for(const auto &package : packages) {
+		try {
+			getPackageSource(package.first, package.second);
+		} catch(SourcePluginException &e) {
+			qWarning().noquote() << QCoreApplication::translate("qpmx::SourcePlugin", "Failed to get sources of package %1 with error: %2")
+									.arg(package.first.toString(), e.qWhat());
+		}
+	}
+}
+
 
 
 SourcePluginException::SourcePluginException(QByteArray errorMessage) :
@@ -8,6 +8,8 @@
 #include <QtCore/QVariantHash>
 #include <QtCore/QJsonObject>
 #include <QtCore/QException>
+#include <QtCore/QList>
+#include <QtCore/QPair>
 
 namespace qpmx { //qpmx public namespace
 
@@ -30,6 +32,10 @@ public:
 	virtual void publishPackage(const QString &provider, const QDir &qpmxDir, const QVersionNumber &version, const QJsonObject &publisherInfo) = 0;
 
 	virtual void cancelAll(int timeout) = 0;
+
+	//added in 1.1 - keep new virtuals behind the existing ones
+	virtual QList<QVersionNumber> findPackageVersions(const QList<qpmx::PackageInfo> &packages);
+	virtual void getPackageSources(const QList<QPair<qpmx::PackageInfo, QDir>> &packages);
 };
 
 class LIBQPMX_EXPORT SourcePluginException : public QException
@@ -51,7 +57,8 @@ protected:
 
 }
 
-#define SourcePlugin_iid "de.skycoder42.qpmx.SourcePlugin"
+#define SourcePlugin_iid "de.skycoder42.qpmx.SourcePlugin/1.1"
+#define SourcePlugin_iid_1_0 "de.skycoder42.qpmx.SourcePlugin"
 Q_DECLARE_INTERFACE(qpmx::SourcePlugin, SourcePlugin_iid)
 
 #endif // QPMX_SOURCEPLUGIN_H
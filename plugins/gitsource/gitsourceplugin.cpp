@@ -2,6 +2,7 @@
 #include <QUrl>
 #include <QStandardPaths>
 #include <QTemporaryDir>
+#include <QHash>
 #include <QSet>
 #include <QTimer>
 #include <QDateTime>
@@ -10,6 +11,7 @@
 #include <QSettings>
 #include <QThread>
 #include <iostream>
+#include <qtcoroutine.h>
 #include <qtcoawaitables.h>
 
 #define print(x) do { \
@@ -115,6 +117,8 @@ QVersionNumber GitSourcePlugin::findPackageVersion(const qpmx::PackageInfo &pack
 	};
 	if(!package.version().isNull())
 		arguments.append(pkgTag(package));
+	else if(prefix.contains(QStringLiteral("%1")))
+		arguments.append(prefix.arg(QStringLiteral("*")));
 	else if(!prefix.isNull())
 		arguments.append(prefix + QLatin1Char('*'));
 
@@ -126,22 +130,9 @@ QVersionNumber GitSourcePlugin::findPackageVersion(const qpmx::PackageInfo &pack
 	proc->deleteLater();
 
 	if(res == EXIT_SUCCESS) {
-		//parse output
+		//same parsing as for batched lookups, so the result does not depend on how packages are grouped
 		qDebug().noquote() << tr("Parsing ls-remote output");
-		QSet<QVersionNumber> versions;
-		QRegularExpression tagRegex(QStringLiteral(R"__(^\w+\trefs\/tags\/(.*)$)__"));
-		for(const auto &line : proc->readAllStandardOutput().split('\n')) {
-			auto match = tagRegex.match(QString::fromUtf8(line));
-			if(match.hasMatch())
-				versions.insert(QVersionNumber::fromString(match.captured(1)));
-		}
-
-		auto vList = versions.toList();
-		std::sort(vList.begin(), vList.end());
-		if(vList.isEmpty())
-			return {};
-		else
-			return vList.last();
+		return matchVersion(package, parseTags(proc));
 	} else if(res == 2)
 		return {};
 	else
@@ -179,6 +170,42 @@ void GitSourcePlugin::getPackageSource(const qpmx::PackageInfo &package, const Q
 		throw qpmx::SourcePluginException{formatProcError(tr("clone versions"), proc)};
 }
 
+QList<QVersionNumber> GitSourcePlugin::findPackageVersions(const QList<qpmx::PackageInfo> &packages)
+{
+	//group by remote, so every repository is only listed once
+	QList<QVersionNumber> versions;
+	versions.reserve(packages.size());
+	QHash<QString, QList<int>> remotes;
+	for(auto i = 0; i < packages.size(); i++) {
+		versions.append(QVersionNumber{});
+		try {
+			QUrl url{pkgUrl(packages[i])};
+			remotes[url.adjusted(QUrl::RemoveFragment).toString()].append(i);
+		} catch(qpmx::SourcePluginException &e) {
+			qWarning().noquote() << tr("Failed to find version of package %1 with error: %2")
+									.arg(packages[i].toString(), e.qWhat());
+		}
+	}
+
+	QtCoroutine::awaitEach(remotes.keys(), [this, &remotes, &packages, &versions](const QString &remote){
+		const auto indexes = remotes.value(remote);
+		try {
+			if(indexes.size() == 1)
+				versions[indexes.first()] = findPackageVersion(packages[indexes.first()]);
+			else {
+				auto tags = listTags(remote);
+				for(auto index : indexes)
+					versions[index] = matchVersion(packages[index], tags);
+			}
+		} catch(qpmx::SourcePluginException &e) {
+			qWarning().noquote() << tr("Failed to list versions of repository %1 with error: %2")
+									.arg(remote, e.qWhat());
+		}
+	});
+
+	return versions;
+}
+
 void GitSourcePlugin::publishPackage(const QString &provider, const QDir &qpmxDir, const QVersionNumber &version, const QJsonObject &publisherInfo)
 {
 	QString url;
@@ -316,6 +343,66 @@ QString GitSourcePlugin::pkgTag(const qpmx::PackageInfo &package)
 	return tag;
 }
 
+QStringList GitSourcePlugin::listTags(const QString &url)
+{
+	QStringList arguments {
+		QStringLiteral("ls-remote"),
+		QStringLiteral("--tags"),
+		url
+	};
+
+	auto proc = createProcess(arguments, true);
+	_processCache.insert(proc);
+	qDebug().noquote() << tr("Listing all tags of repository %1").arg(url);
+	auto res = QtCoroutine::await(proc);
+	_processCache.remove(proc);
+	proc->deleteLater();
+	if(res != EXIT_SUCCESS)
+		throw qpmx::SourcePluginException{formatProcError(tr("list versions"), proc)};
+	return parseTags(proc);
+}
+
+QStringList GitSourcePlugin::parseTags(QProcess *proc)
+{
+	QStringList tags;
+	QRegularExpression tagRegex(QStringLiteral(R"__(^\w+\trefs\/tags\/(.*?)(?:\^\{\})?$)__"));
+	for(const auto &line : proc->readAllStandardOutput().split('\n')) {
+		auto match = tagRegex.match(QString::fromUtf8(line));
+		if(match.hasMatch())
+			tags.append(match.captured(1));
+	}
+	tags.removeDuplicates();
+	return tags;
+}
+
+QVersionNumber GitSourcePlugin::matchVersion(const qpmx::PackageInfo &package, const QStringList &tags)
+{
+	if(!package.version().isNull())
+		return tags.contains(pkgTag(package)) ? package.version() : QVersionNumber{};
+
+	QString prefix;
+	pkgUrl(package, &prefix);
+	QRegularExpression versionRegex;
+	if(prefix.contains(QStringLiteral("%1"))) {
+		auto parts = prefix.split(QStringLiteral("%1"));
+		versionRegex.setPattern(QStringLiteral("^%1(.*)%2$")
+								.arg(QRegularExpression::escape(parts.value(0)),
+									 QRegularExpression::escape(parts.mid(1).join(QStringLiteral("%1")))));
+	} else
+		versionRegex.setPattern(QStringLiteral("^%1(.*)$").arg(QRegularExpression::escape(prefix)));
+
+	QVersionNumber latest;
+	for(const auto &tag : tags) {
+		auto match = versionRegex.match(tag);
+		if(!match.hasMatch())
+			continue;
+		auto version = QVersionNumber::fromString(match.captured(1));
+		if(version > latest)
+			latest = version;
+	}
+	return latest;
+}
+
 QProcess *GitSourcePlugin::createProcess(const QStringList &arguments, bool keepStdout)
 {
 	auto proc = new QProcess(this);
@@ -39,12 +39,17 @@ public:
 
 	void cancelAll(int timeout) override;
 
+	QList<QVersionNumber> findPackageVersions(const QList<qpmx::PackageInfo> &packages) override;
+
 private:
 	static QRegularExpression _githubRegex;
 	QSet<QProcess*> _processCache;
 
 	QString pkgUrl(const qpmx::PackageInfo &package, QString *prefix = nullptr);
 	QString pkgTag(const qpmx::PackageInfo &package);
+	QStringList listTags(const QString &url);
+	QStringList parseTags(QProcess *proc);
+	QVersionNumber matchVersion(const qpmx::PackageInfo &package, const QStringList &tags);
 
 	QProcess *createProcess(const QStringList &arguments, bool keepStdout = false);
 	QString formatProcError(const QString &type, QProcess *proc);
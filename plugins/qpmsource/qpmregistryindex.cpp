@@ -0,0 +1,264 @@
+#include "qpmregistryindex.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <algorithm>
+#include <libqpmx.h>
+
+const quint32 QpmRegistryIndex::IndexMagic = 0x51504d49;
+const quint16 QpmRegistryIndex::IndexVersion = 3;
+
+QpmRegistryIndex::QpmRegistryIndex() :
+	_loaded(false),
+	_dirty(false),
+	_dumpPath(),
+	_dumpModified(0),
+	_dumpSize(-1),
+	_packages()
+{}
+
+QpmRegistryIndex::~QpmRegistryIndex()
+{
+	saveIndex();
+}
+
+bool QpmRegistryIndex::canSearch()
+{
+	update();
+	return !_dumpPath.isEmpty();
+}
+
+QStringList QpmRegistryIndex::search(const QString &query)
+{
+	update();
+	QStringList results;
+	for(auto it = _packages.constBegin(); it != _packages.constEnd(); it++) {
+		if(it.key().contains(query, Qt::CaseInsensitive) ||
+		   it->description.contains(query, Qt::CaseInsensitive))
+			results.append(it.key());
+	}
+	results.sort();
+	return results;
+}
+
+QVersionNumber QpmRegistryIndex::latestVersion(const QString &package)
+{
+	//only the dump knows about new releases - observed versions can be outdated
+	update();
+	if(_dumpPath.isEmpty())
+		return {};
+	auto it = _packages.constFind(key(package));
+	if(it == _packages.constEnd() || !it->fromRegistry || it->versions.isEmpty())
+		return {};
+	return *std::max_element(it->versions.constBegin(), it->versions.constEnd());
+}
+
+void QpmRegistryIndex::record(const QString &package, const QVersionNumber &version, const QString &description)
+{
+	if(version.isNull())
+		return;
+	update();
+
+	//only marked as changed here - the index is written once by flush() or on destruction
+	auto &pkg = _packages[key(package)];
+	pkg.versions.insert(version);
+	if(!description.isEmpty())
+		pkg.description = description;
+	_dirty = true;
+}
+
+void QpmRegistryIndex::flush()
+{
+	saveIndex();
+}
+
+void QpmRegistryIndex::update()
+{
+	if(!_loaded) {
+		_loaded = true;
+		if(!loadIndex()) {
+			_packages.clear();
+			_dumpPath.clear();
+			_dumpModified = 0;
+			_dumpSize = -1;
+		}
+	}
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+	auto dumpPath = qEnvironmentVariable("QPMX_QPM_REGISTRY");
+#else
+	auto dumpPath = QString::fromUtf8(qgetenv("QPMX_QPM_REGISTRY"));
+#endif
+	if(dumpPath.isEmpty()) {
+		_dumpPath.clear();
+		return;
+	}
+
+	QFileInfo dumpInfo{dumpPath};
+	if(!dumpInfo.exists()) {
+		qWarning().noquote() << tr("qpm registry dump %1 does not exist - ignoring it").arg(dumpPath);
+		_dumpPath.clear();
+		return;
+	}
+
+	dumpPath = dumpInfo.absoluteFilePath();
+	auto modified = dumpInfo.lastModified().toMSecsSinceEpoch();
+	if(dumpPath != _dumpPath ||
+	   modified != _dumpModified ||
+	   dumpInfo.size() != _dumpSize) {
+		loadDump(dumpPath);
+		_dumpPath = dumpPath;
+		_dumpModified = modified;
+		_dumpSize = dumpInfo.size();
+		_dirty = true;
+	}
+}
+
+bool QpmRegistryIndex::loadIndex()
+{
+	QFile indexFile{indexPath()};
+	if(!indexFile.exists())
+		return false;
+	if(!indexFile.open(QIODevice::ReadOnly)) {
+		qWarning().noquote() << tr("Failed to open qpm registry index with error: %1").arg(indexFile.errorString());
+		return false;
+	}
+
+	QDataStream stream{&indexFile};
+	quint32 magic;
+	quint16 version;
+	stream >> magic >> version;
+	if(magic != IndexMagic || version != IndexVersion) {
+		qDebug().noquote() << tr("Discarding qpm registry index of unknown format");
+		return false;
+	}
+	stream.setVersion(QDataStream::Qt_5_6);
+
+	quint32 count;
+	stream >> _dumpPath >> _dumpModified >> _dumpSize >> count;
+	_packages.reserve(static_cast<int>(count));
+	for(quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+		QString name;
+		Package pkg;
+		stream >> name
+			   >> pkg.description
+			   >> pkg.versions
+			   >> pkg.fromRegistry;
+		_packages.insert(name, pkg);
+	}
+
+	if(stream.status() != QDataStream::Ok) {
+		qWarning().noquote() << tr("qpm registry index is corrupted - rebuilding it");
+		return false;
+	}
+	qDebug().noquote() << tr("Loaded qpm registry index with %n package(s)", "", _packages.size());
+	return true;
+}
+
+void QpmRegistryIndex::saveIndex()
+{
+	if(!_dirty)
+		return;
+
+	QDir cacheDir{qpmx::qpmxCacheDir()};
+	if(!cacheDir.mkpath(QStringLiteral("qpm"))) {
+		qWarning().noquote() << tr("Failed to create qpm registry index directory");
+		return;
+	}
+
+	QSaveFile indexFile{indexPath()};
+	if(!indexFile.open(QIODevice::WriteOnly)) {
+		qWarning().noquote() << tr("Failed to save qpm registry index with error: %1").arg(indexFile.errorString());
+		return;
+	}
+
+	QDataStream stream{&indexFile};
+	stream << IndexMagic << IndexVersion;
+	stream.setVersion(QDataStream::Qt_5_6);
+	stream << _dumpPath
+		   << _dumpModified
+		   << _dumpSize
+		   << static_cast<quint32>(_packages.size());
+	for(auto it = _packages.constBegin(); it != _packages.constEnd(); it++) {
+		stream << it.key()
+			   << it->description
+			   << it->versions
+			   << it->fromRegistry;
+	}
+
+	if(!indexFile.commit())
+		qWarning().noquote() << tr("Failed to save qpm registry index with error: %1").arg(indexFile.errorString());
+	else
+		_dirty = false;
+}
+
+void QpmRegistryIndex::loadDump(const QString &path)
+{
+	QFile dumpFile{path};
+	if(!dumpFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		qWarning().noquote() << tr("Failed to open qpm registry dump with error: %1").arg(dumpFile.errorString());
+		return;
+	}
+
+	QJsonParseError error;
+	auto doc = QJsonDocument::fromJson(dumpFile.readAll(), &error);
+	if(error.error != QJsonParseError::NoError) {
+		qWarning().noquote() << tr("Failed to read qpm registry dump with error: %1").arg(error.errorString());
+		return;
+	}
+	dumpFile.close();
+
+	auto pkgArray = doc.isArray() ?
+						doc.array() :
+						doc.object()[QStringLiteral("packages")].toArray();
+
+	//drop registry entries that vanished from the dump, keep observed ones
+	for(auto it = _packages.begin(); it != _packages.end();) {
+		if(it->fromRegistry)
+			it = _packages.erase(it);
+		else
+			it++;
+	}
+
+	for(auto value : pkgArray) {
+		auto pkgObj = value.toObject();
+		auto name = key(pkgObj[QStringLiteral("name")].toString());
+		if(name.isEmpty())
+			continue;
+
+		auto &pkg = _packages[name];
+		pkg.fromRegistry = true;
+		pkg.description = pkgObj[QStringLiteral("description")].toString();
+
+		auto versions = pkgObj[QStringLiteral("versions")].toArray();
+		if(versions.isEmpty() && pkgObj.contains(QStringLiteral("version")))
+			versions.append(pkgObj);
+		for(auto vValue : versions) {
+			auto vObj = vValue.toObject();
+			auto label = vObj[QStringLiteral("version")].isObject() ?
+							 vObj[QStringLiteral("version")].toObject()[QStringLiteral("label")].toString() :
+							 vObj[QStringLiteral("label")].toString();
+			auto version = QVersionNumber::fromString(label);
+			if(!version.isNull())
+				pkg.versions.insert(version);
+		}
+	}
+
+	qDebug().noquote() << tr("Indexed %n package(s) from qpm registry dump", "", pkgArray.size());
+}
+
+QString QpmRegistryIndex::key(const QString &package)
+{
+	//qpm package ids are case insensitive
+	return package.toLower();
+}
+
+QString QpmRegistryIndex::indexPath() const
+{
+	return qpmx::qpmxCacheDir().absoluteFilePath(QStringLiteral("qpm/registry.idx"));
+}
@@ -0,0 +1,53 @@
+#ifndef QPMREGISTRYINDEX_H
+#define QPMREGISTRYINDEX_H
+
+#include <QCoreApplication>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QVersionNumber>
+
+class QpmRegistryIndex
+{
+	Q_DECLARE_TR_FUNCTIONS(QpmRegistryIndex)
+
+public:
+	QpmRegistryIndex();
+	~QpmRegistryIndex();
+
+	bool canSearch();
+	QStringList search(const QString &query);
+	QVersionNumber latestVersion(const QString &package);
+
+	void record(const QString &package,
+				const QVersionNumber &version,
+				const QString &description = {});
+	void flush();
+
+private:
+	static const quint32 IndexMagic;
+	static const quint16 IndexVersion;
+
+	struct Package {
+		QString description;
+		QSet<QVersionNumber> versions;
+		bool fromRegistry = false;
+	};
+
+	bool _loaded;
+	bool _dirty;
+	QString _dumpPath;
+	qint64 _dumpModified;
+	qint64 _dumpSize;
+	QHash<QString, Package> _packages;
+
+	static QString key(const QString &package);
+
+	void update();
+	bool loadIndex();
+	void saveIndex();
+	void loadDump(const QString &path);
+	QString indexPath() const;
+};
+
+#endif // QPMREGISTRYINDEX_H
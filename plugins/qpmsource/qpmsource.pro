@@ -10,10 +10,12 @@ QMAKE_TARGET_DESCRIPTION = "qpmx qpm Plug-In"
 DESTDIR = $$OUT_PWD/../qpmx
 
 HEADERS += \
-	qpmsourceplugin.h
+	qpmsourceplugin.h \
+	qpmregistryindex.h
 
 SOURCES += \
-	qpmsourceplugin.cpp
+	qpmsourceplugin.cpp \
+	qpmregistryindex.cpp
 
 include(../../lib.pri)
 
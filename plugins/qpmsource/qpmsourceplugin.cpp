@@ -14,7 +14,8 @@ QpmSourcePlugin::QpmSourcePlugin(QObject *parent) :
 	QObject(parent),
 	SourcePlugin(),
 	_processCache(),
-	_cachedDownloads()
+	_cachedDownloads(),
+	_index()
 {}
 
 QpmSourcePlugin::~QpmSourcePlugin()
@@ -104,6 +105,11 @@ QStringList QpmSourcePlugin::searchPackage(const QString &provider, const QStrin
 	if(provider != QStringLiteral("qpm"))
 		throw qpmx::SourcePluginException{tr("Unsupported provider \"%1\"").arg(provider)};
 
+	if(_index.canSearch()) {
+		qDebug().noquote() << tr("Searching qpm registry index for query: %1").arg(query);
+		return _index.search(query);
+	}
+
 	QStringList arguments{
 		QStringLiteral("search"),
 		query
@@ -138,6 +144,12 @@ QVersionNumber QpmSourcePlugin::findPackageVersion(const qpmx::PackageInfo &pack
 	if(package.provider() != QStringLiteral("qpm"))
 		throw qpmx::SourcePluginException{tr("Unsupported provider \"%1\"").arg(package.provider())};
 
+	auto indexVersion = _index.latestVersion(package.package());
+	if(!indexVersion.isNull()) {
+		qDebug().noquote() << tr("Found latest version of qpm package %1 in registry index").arg(package.package());
+		return indexVersion;
+	}
+
 	//run qpm install, to a cached temp dir, only "safe" way
 	auto dir = qpmx::tmpDir();
 	QTemporaryDir tmpDir{dir.absoluteFilePath(QStringLiteral("qpm.XXXXXX"))};
@@ -182,8 +194,14 @@ QVersionNumber QpmSourcePlugin::findPackageVersion(const qpmx::PackageInfo &pack
 	auto versionLabel = versionObj[QStringLiteral("label")].toString();
 	auto version = QVersionNumber::fromString(versionLabel);
 
-	if(!version.isNull())
+	_index.record(package.package(),
+				  version,
+				  qpmRoot[QStringLiteral("description")].toString());
+
+	if(!version.isNull()) {
+		tmpDir.setAutoRemove(false);
 		_cachedDownloads.insert({package.provider(), package.package(), version}, tDir.absolutePath());
+	}
 	return version;
 }
 
@@ -247,6 +265,119 @@ void QpmSourcePlugin::getPackageSource(const qpmx::PackageInfo &package, const Q
 	qpmTransform(tDir);
 }
 
+QList<QVersionNumber> QpmSourcePlugin::findPackageVersions(const QList<qpmx::PackageInfo> &packages)
+{
+	QList<QVersionNumber> versions;
+	versions.reserve(packages.size());
+	QList<int> pending;
+	for(auto i = 0; i < packages.size(); i++) {
+		versions.append(_index.latestVersion(packages[i].package()));
+		if(versions.last().isNull() && packages[i].provider() == QStringLiteral("qpm"))
+			pending.append(i);
+	}
+	if(pending.isEmpty())
+		return versions;
+
+	QList<qpmx::PackageInfo> pendingPkgs;
+	QStringList qpmPackages;
+	for(auto index : pending) {
+		pendingPkgs.append(packages[index]);
+		qpmPackages.append(packages[index].package());
+	}
+
+	//a single install for all packages, falls back to one install per package on failure
+	QTemporaryDir tmpDir{qpmx::tmpDir().absoluteFilePath(QStringLiteral("qpm.XXXXXX"))};
+	if(pending.size() == 1 || !batchInstall(qpmPackages, tmpDir.path())) {
+		auto found = SourcePlugin::findPackageVersions(pendingPkgs);
+		for(auto i = 0; i < pending.size(); i++)
+			versions[pending[i]] = found[i];
+		return versions;
+	}
+
+	QDir tDir{tmpDir.path()};
+	for(auto index : pending) {
+		const auto &package = packages[index];
+		auto subPath = vendorPath(package.package());
+		QFile inFile{tDir.absoluteFilePath(subPath + QStringLiteral("/qpm.json"))};
+		if(!inFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+			qDebug().noquote() << tr("qpm did not install package %1 in batch, resolving it on it's own").arg(package.package());
+			try {
+				versions[index] = findPackageVersion(package);
+			} catch(qpmx::SourcePluginException &e) {
+				qWarning().noquote() << tr("Failed to find version of package %1 with error: %2")
+										.arg(package.toString(), e.qWhat());
+			}
+			continue;
+		}
+
+		auto qpmRoot = QJsonDocument::fromJson(inFile.readAll()).object();
+		auto version = QVersionNumber::fromString(qpmRoot[QStringLiteral("version")].toObject()[QStringLiteral("label")].toString());
+		_index.record(package.package(),
+					  version,
+					  qpmRoot[QStringLiteral("description")].toString());
+		versions[index] = version;
+		inFile.close();
+
+		//keep the sources for getPackageSource, each in it's own dir as that one consumes the whole dir
+		if(!version.isNull())
+			cacheDownload({package.provider(), package.package(), version}, tDir, subPath);
+	}
+
+	return versions;
+}
+
+void QpmSourcePlugin::getPackageSources(const QList<QPair<qpmx::PackageInfo, QDir>> &allPackages)
+{
+	//sources downloaded by a version lookup are already there
+	QList<QPair<qpmx::PackageInfo, QDir>> cached;
+	QList<QPair<qpmx::PackageInfo, QDir>> packages;
+	for(const auto &package : allPackages) {
+		if(_cachedDownloads.contains(package.first))
+			cached.append(package);
+		else
+			packages.append(package);
+	}
+	SourcePlugin::getPackageSources(cached);
+	if(packages.isEmpty())
+		return;
+
+	QStringList qpmPackages;
+	for(const auto &package : qAsConst(packages)) {
+		if(package.first.provider() != QStringLiteral("qpm") || package.first.version().isNull()) {
+			SourcePlugin::getPackageSources(packages);
+			return;
+		}
+		qpmPackages.append(package.first.package() + QLatin1Char('@') + package.first.version().toString());
+	}
+
+	QTemporaryDir tmpDir{qpmx::tmpDir().absoluteFilePath(QStringLiteral("qpm.XXXXXX"))};
+	if(packages.size() == 1 || !batchInstall(qpmPackages, tmpDir.path())) {
+		SourcePlugin::getPackageSources(packages);
+		return;
+	}
+
+	QDir tDir{tmpDir.path()};
+	for(const auto &package : packages) {
+		try {
+			auto subPath = vendorPath(package.first.package());
+			if(!tDir.exists(QStringLiteral("%1/qpm.json").arg(subPath))) {
+				getPackageSource(package.first, package.second);
+				continue;
+			}
+
+			auto targetDir = package.second;
+			if(!targetDir.removeRecursively())
+				throw qpmx::SourcePluginException{tr("Failed to remove dummy directory")};
+			if(!tDir.rename(subPath, targetDir.absolutePath()))
+				throw qpmx::SourcePluginException{tr("Failed to move sources to tmp dir")};
+			qpmTransform(targetDir);
+		} catch(qpmx::SourcePluginException &e) {
+			qWarning().noquote() << tr("Failed to get sources of package %1 with error: %2")
+									.arg(package.first.toString(), e.qWhat());
+		}
+	}
+}
+
 void QpmSourcePlugin::publishPackage(const QString &provider, const QDir &qpmxDir, const QVersionNumber &version, const QJsonObject &publisherInfo)
 {
 	if(provider != QStringLiteral("qpm"))
@@ -342,6 +473,7 @@ void QpmSourcePlugin::cancelAll(int timeout)
 	}
 
 	cleanCaches();
+	_index.flush();
 }
 
 QProcess *QpmSourcePlugin::createProcess(const QStringList &arguments, bool keepStdout, bool timeout)
@@ -385,6 +517,46 @@ QString QpmSourcePlugin::formatProcError(const QString &type, QProcess *proc)
 	}
 }
 
+bool QpmSourcePlugin::batchInstall(const QStringList &qpmPackages, const QDir &workingDir)
+{
+	QStringList arguments{QStringLiteral("install")};
+	arguments.append(qpmPackages);
+
+	auto proc = createProcess(arguments);
+	proc->setWorkingDirectory(workingDir.absolutePath());
+	_processCache.insert(proc);
+	qDebug().noquote() << tr("Running qpm install for %n qpm package(s)", "", qpmPackages.size());
+	auto res = QtCoroutine::await(proc);
+	_processCache.remove(proc);
+	proc->deleteLater();
+	if(res != EXIT_SUCCESS) {
+		qDebug().noquote() << formatProcError(tr("install qpm packages at once"), proc);
+		return false;
+	} else
+		return true;
+}
+
+void QpmSourcePlugin::cacheDownload(const qpmx::PackageInfo &package, const QDir &batchDir, const QString &subPath)
+{
+	QTemporaryDir cacheDir{qpmx::tmpDir().absoluteFilePath(QStringLiteral("qpm.XXXXXX"))};
+	QDir cDir{cacheDir.path()};
+	if(!cacheDir.isValid() ||
+	   !cDir.mkpath(QFileInfo{subPath}.path()) ||
+	   !QDir{}.rename(batchDir.absoluteFilePath(subPath), cDir.absoluteFilePath(subPath))) {
+		qDebug().noquote() << tr("Failed to cache qpm sources of package %1").arg(package.toString());
+		return;
+	}
+
+	cleanCache(package);
+	cacheDir.setAutoRemove(false);
+	_cachedDownloads.insert(package, cDir.absolutePath());
+}
+
+QString QpmSourcePlugin::vendorPath(const QString &package) const
+{
+	return QStringLiteral("vendor/%1").arg(QString{package}.replace(QLatin1Char('.'), QLatin1Char('/')));
+}
+
 bool QpmSourcePlugin::completeCopyInstall(const qpmx::PackageInfo &package, QDir targetDir, QDir sourceDir)
 {
 	//verify cached sources, just in case
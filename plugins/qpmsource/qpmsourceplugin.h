@@ -3,6 +3,8 @@
 
 #include <sourceplugin.h>
 
+#include "qpmregistryindex.h"
+
 #include <QProcess>
 #include <QHash>
 #include <QSet>
@@ -39,12 +41,19 @@ public:
 
 	void cancelAll(int timeout) override;
 
+	QList<QVersionNumber> findPackageVersions(const QList<qpmx::PackageInfo> &packages) override;
+	void getPackageSources(const QList<QPair<qpmx::PackageInfo, QDir>> &packages) override;
+
 private:
 	QSet<QProcess*> _processCache;
 	QHash<qpmx::PackageInfo, QString> _cachedDownloads;
+	QpmRegistryIndex _index;
 
 	QProcess *createProcess(const QStringList &arguments, bool keepStdout = false, bool timeout = true);
 	QString formatProcError(const QString &type, QProcess *proc);
+	bool batchInstall(const QStringList &qpmPackages, const QDir &workingDir);
+	void cacheDownload(const qpmx::PackageInfo &package, const QDir &batchDir, const QString &subPath);
+	QString vendorPath(const QString &package) const;
 
 	bool completeCopyInstall(const qpmx::PackageInfo &package, QDir targetDir, QDir sourceDir);
 
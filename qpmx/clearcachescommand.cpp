@@ -44,6 +44,8 @@ void ClearCachesCommand::initialize(QCliParser &parser)
 			xWarning() << tr("Failed to completly remove temporary files");
 		else
 			xDebug() << tr("Removed temporary files");
+		if(!QDir{cacheDir().absoluteFilePath(QStringLiteral("init"))}.removeRecursively())
+			xWarning() << tr("Failed to completly remove init markers");
 		if(!buildDir().removeRecursively())
 			xWarning() << tr("Failed to completly remove cached build files");
 		else
@@ -54,7 +56,16 @@ void ClearCachesCommand::initialize(QCliParser &parser)
 			else
 				xDebug() << tr("Removed cached source files");
 		}
-		qApp->quit();
+		//the lockfiles themselves are removed on unlocking, only the ones for shared locking stay
+		auto lDir = lockDir(false);
+		auto removedLocks = true;
+		for(const auto &lockFile : lDir.entryList({QStringLiteral("*.rw"), QStringLiteral("*.gate")}, QDir::Files))
+			removedLocks = lDir.remove(lockFile) && removedLocks;
+		if(!removedLocks)
+			xWarning() << tr("Failed to completly remove lock files");
+		else
+			xDebug() << tr("Removed lock files");
+		quit();
 	} catch (QString &s) {
 		xCritical() << s;
 	}
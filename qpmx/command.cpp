@@ -1,21 +1,246 @@
 #include "command.h"
 #include <QDateTime>
+#include <QFile>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QMutex>
+#include <QThread>
 #include <QRegularExpression>
 #include <QStandardPaths>
+#include <QTimer>
 #include <QUrl>
 
 #include <QProcess>
+#include <QSet>
 #include <iostream>
 #include <chrono>
+#include <exception>
 #ifdef Q_OS_UNIX
 #include <sys/ioctl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
+#include <qtcoroutine.h>
 #include <qtcoawaitables.h>
 using namespace qpmx;
 
+namespace {
+
+struct LockStats {
+	int waits = 0;
+	qint64 total = 0;
+	qint64 longest = 0;
+};
+
+QMutex lockStatsMutex;
+QMap<QString, LockStats> lockStats;
+
+// flock and QLockFile both conflict with locks of the same process, so a task that mixes modes on one path waits for itself forever
+using LockOwner = QPair<QString, QtCoroutine::RoutineId>;
+QMutex heldLocksMutex;
+QHash<LockOwner, int> heldLocks; //number of shared holds or -1 if locked exclusively
+
+QtCoroutine::RoutineId registerLock(const QString &path, bool exclusive)
+{
+	QMutexLocker _{&heldLocksMutex};
+	LockOwner owner{path, QtCoroutine::current()};
+	auto held = heldLocks.value(owner, 0);
+	if(held == -1 || (exclusive && held > 0)) {
+		throw Command::tr("Lockfile-error on file %{bld}%1%{end}: %2")
+				.arg(path, held == -1 ?
+						 Command::tr("Already locked exclusively by this task") :
+						 Command::tr("Already locked shared by this task"));
+	}
+	heldLocks.insert(owner, exclusive ? -1 : held + 1);
+	return owner.second;
+}
+
+void unregisterLock(const QString &path, QtCoroutine::RoutineId routine)
+{
+	QMutexLocker _{&heldLocksMutex};
+	LockOwner owner{path, routine};
+	auto held = heldLocks.value(owner, 0);
+	if(held > 1)
+		heldLocks.insert(owner, held - 1);
+	else
+		heldLocks.remove(owner);
+}
+
+// polls a lock with exponential backoff, reports who holds it and records the time spent waiting
+class LockWaiter
+{
+public:
+	LockWaiter(QString path, int timeout) :
+		_path{std::move(path)},
+		_timeout{timeout}
+	{}
+
+	~LockWaiter() {
+		if(!_timer.isValid())
+			return;
+		auto waited = _timer.elapsed();
+		QMutexLocker _{&lockStatsMutex};
+		auto &stats = lockStats[QFileInfo{_path}.fileName()];
+		stats.waits++;
+		stats.total += waited;
+		stats.longest = qMax(stats.longest, waited);
+	}
+
+	bool next(const std::function<QString()> &holder = {}) {
+		if(!_timer.isValid())
+			_timer.start();
+		auto elapsed = _timer.elapsed();
+		if(_timeout > 0 && elapsed >= _timeout)
+			return false;
+
+		if(elapsed >= _nextReport) {
+			auto holderStr = holder ? holder() : QString{};
+			if(holderStr.isEmpty()) {
+				xInfo() << Command::tr("Waiting for lock %{bld}%1%{end} (%2s)...")
+						   .arg(_path)
+						   .arg(elapsed / 1000);
+			} else {
+				xInfo() << Command::tr("Waiting for lock %{bld}%1%{end} held by %2 (%3s)...")
+						   .arg(_path, holderStr)
+						   .arg(elapsed / 1000);
+			}
+			_nextReport = elapsed + 10000;
+		}
+
+		auto delay = qMax<qint64>(_backoff, 1);
+		if(_timeout > 0)
+			delay = qMax<qint64>(qMin(delay, _timeout - elapsed), 1);
+		//a waiting task only suspends itself, so the other tasks and timers keep running meanwhile
+		auto routine = QtCoroutine::current();
+		if(routine != 0) {
+			QTimer::singleShot(static_cast<int>(delay), [routine](){
+				QtCoroutine::resume(routine);
+			});
+			QtCoroutine::yield();
+		} else
+			QThread::msleep(static_cast<unsigned long>(delay));
+		_backoff = qMin<qint64>(_backoff * 2, 2000);
+		return true;
+	}
+
+	QString timeoutError() const {
+		return Command::tr("Timed out after waiting %1s for the lock").arg(_timer.elapsed() / 1000);
+	}
+
+private:
+	QString _path;
+	int _timeout;
+	QElapsedTimer _timer;
+	qint64 _backoff = 25;
+	qint64 _nextReport = 1000;
+};
+
+}
+
+#ifdef Q_OS_UNIX
+namespace {
+
+// reader/writer locks via flock: the data file is locked shared by readers and exclusive by writers.
+// Both first pass the gate file, which a waiting writer keeps locked, so new readers cannot starve it.
+QString rwDataPath(const QString &lockPath)
+{
+	return lockPath + QStringLiteral(".rw");
+}
+
+QString rwGatePath(const QString &lockPath)
+{
+	return lockPath + QStringLiteral(".gate");
+}
+
+int openRwFile(const QString &path)
+{
+	auto fd = ::open(QFile::encodeName(path).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd == -1) {
+		throw Command::tr("Lockfile-error on file %{bld}%1%{end}: %2")
+				.arg(path, qt_error_string(errno));
+	}
+	return fd;
+}
+
+void flockFile(int fd, int operation, const QString &path, LockWaiter &waiter)
+{
+	forever {
+		if(::flock(fd, operation | LOCK_NB) == 0)
+			return;
+		if(errno == EINTR)
+			continue;
+		if(errno != EWOULDBLOCK) {
+			throw Command::tr("Lockfile-error on file %{bld}%1%{end}: %2")
+					.arg(path, qt_error_string(errno));
+		}
+		if(!waiter.next()) {
+			throw Command::tr("Lockfile-error on file %{bld}%1%{end}: %2")
+					.arg(path, waiter.timeoutError());
+		}
+	}
+}
+
+// lock files get removed together with their package, so a lock on an already unlinked file must be retried
+int lockRwFile(const QString &path, int operation, LockWaiter &waiter)
+{
+	forever {
+		auto fd = openRwFile(path);
+		try {
+			flockFile(fd, operation, path, waiter);
+		} catch(...) {
+			::close(fd);
+			throw;
+		}
+
+		struct stat fdStat;
+		struct stat pathStat;
+		if(::fstat(fd, &fdStat) == 0 &&
+		   ::stat(QFile::encodeName(path).constData(), &pathStat) == 0 &&
+		   fdStat.st_dev == pathStat.st_dev &&
+		   fdStat.st_ino == pathStat.st_ino)
+			return fd;
+		::close(fd);
+	}
+}
+
+int rwLock(const QString &lockPath, bool exclusive, LockWaiter &waiter)
+{
+	auto gatePath = rwGatePath(lockPath);
+	auto dataPath = rwDataPath(lockPath);
+	auto gateFd = lockRwFile(gatePath, LOCK_EX, waiter);
+	auto dataFd = -1;
+	try {
+		dataFd = lockRwFile(dataPath, exclusive ? LOCK_EX : LOCK_SH, waiter);
+	} catch(...) {
+		if(dataFd != -1)
+			::close(dataFd);
+		::close(gateFd);
+		throw;
+	}
+	::close(gateFd); //closing releases the gate
+	return dataFd;
+}
+
+void rwUnlock(int &fd)
+{
+	if(fd != -1) {
+		::flock(fd, LOCK_UN);
+		::close(fd);
+		fd = -1;
+	}
+}
+
+}
+#endif
+
 int Command::_ExitCode = EXIT_FAILURE;
+bool Command::_Failed = false;
+bool Command::_DaemonMode = false;
 
 Command::Command(QObject *parent) :
 	QObject{parent},
@@ -56,6 +281,12 @@ void Command::setupParser(QCliParser &parser, const QHash<QString, Command *> &c
 							"one dev build cache between multiple projects. The default path is the directory of the qpmx.json file."),
 						 tr("path")
 					 });
+	parser.addOption({
+						 QStringLiteral("jobs"),
+						 tr("The maximum <number> of provider operations (searches, version lookups and downloads) "
+							"and package compilations that are run in parallel. The default is 5 or the \"jobs\" value from the settings."),
+						 tr("number")
+					 });
 	QCommandLineOption qOpt(QStringLiteral("qmake-run"));
 	qOpt.setFlags(QCommandLineOption::HiddenFromHelp);
 	parser.addOption(qOpt);
@@ -76,15 +307,50 @@ void Command::init(QCliParser &parser)
 #endif
 	_qmakeRun = parser.isSet(QStringLiteral("qmake-run"));
 	_cacheDir = parser.value(QStringLiteral("dev-cache"));
+	if(parser.isSet(QStringLiteral("jobs")))
+		_jobs = parser.value(QStringLiteral("jobs")).toInt();
+	else
+		_jobs = _settings->value(QStringLiteral("jobs"), _jobs).toInt();
+	if(_jobs < 1) {
+		xWarning() << tr("Invalid number of jobs. Running provider operations sequentially");
+		_jobs = 1;
+	}
 
 	qsrand(static_cast<uint>(QDateTime::currentMSecsSinceEpoch()));
 	initialize(parser);
 }
 
+void Command::setupFrom(const Command &other)
+{
+	_verbose = other._verbose;
+	_quiet = other._quiet;
+#ifndef Q_OS_WIN
+	_noColor = other._noColor;
+#endif
+	_qmakeRun = other._qmakeRun;
+	_cacheDir = other._cacheDir;
+	_jobs = other._jobs;
+	_taskPool = other._taskPool;
+}
+
 void Command::fin()
 {
 	finalize();
 	_registry->cancelAll();
+
+	auto stats = QpmxFormat::readStats();
+	xDebug() << tr("Parsed %n qpmx file(s)", "", stats.parsed)
+			 << tr("(%n loaded from binary sidecars,", "", stats.binary)
+			 << tr("%n read(s) served from cache)", "", stats.cached);
+
+	QMutexLocker _{&lockStatsMutex};
+	for(auto it = lockStats.constBegin(); it != lockStats.constEnd(); it++) {
+		xDebug() << tr("Waited %1ms for lock %{bld}%2%{end}")
+					.arg(it->total)
+					.arg(it.key())
+				 << tr("(%n time(s), longest wait %1ms)", "", it->waits)
+					.arg(it->longest);
+	}
 }
 
 int Command::exitCode()
@@ -92,6 +358,23 @@ int Command::exitCode()
 	return _ExitCode;
 }
 
+void Command::resetStats()
+{
+	QpmxFormat::resetStats();
+	QMutexLocker _{&lockStatsMutex};
+	lockStats.clear();
+}
+
+bool Command::failed()
+{
+	return _Failed;
+}
+
+void Command::markFailed()
+{
+	_Failed = true;
+}
+
 QDir Command::subDir(QDir dir, const QString &provider, const QString &package, const QVersionNumber &version, bool mkDir)
 {
 	if(mkDir) {
@@ -172,11 +455,47 @@ Command::CacheLock Command::pkgLock(const QpmxDevDependency &dep) const
 	return lock(dep.toString(false), dep.isDev());
 }
 
+Command::SharedCacheLock Command::pkgReadLock(const PackageInfo &package) const
+{
+	if(!package.isComplete())
+		throw tr("Locks require full packages");
+	return sharedLock(package.toString(false));
+}
+
+Command::SharedCacheLock Command::pkgReadLock(const QpmxDevDependency &dep) const
+{
+	if(!dep.pkg().isComplete())
+		throw tr("Locks require full packages");
+	return sharedLock(dep.toString(false), dep.isDev());
+}
+
+Command::CacheLock Command::buildLock(const BuildId &kitId, const QpmxDevDependency &dep) const
+{
+	if(!dep.pkg().isComplete())
+		throw tr("Locks require full packages");
+	return lock(QStringLiteral("build/") + kitId + QLatin1Char('/') + dep.toString(false), dep.isDev());
+}
+
 Command::CacheLock Command::kitLock() const
 {
 	return lock(QStringLiteral("qt-kits.ini"));
 }
 
+Command::SharedCacheLock Command::kitReadLock() const
+{
+	return sharedLock(QStringLiteral("qt-kits.ini"));
+}
+
+Command::CacheLock Command::initLock(const QString &projectKey) const
+{
+	return lock(QStringLiteral("init-") + projectKey);
+}
+
+Command::CacheLock Command::searchIndexLock() const
+{
+	return lock(QStringLiteral("search.idx"));
+}
+
 QList<PackageInfo> Command::readCliPackages(const QStringList &arguments, bool fullPkgOnly) const
 {
 	QList<PackageInfo> pkgList;
@@ -221,12 +540,24 @@ QList<QpmxDevDependency> Command::devDepList(const QList<PackageInfo> &pkgList)
 	return depList;
 }
 
-void Command::replaceAlias(QpmxDependency &original, const QList<QpmxDevAlias> &aliases)
+Command::AliasMap Command::aliasMap(const QList<QpmxDevAlias> &aliases)
 {
-	auto aIndex = aliases.indexOf(original);
-	if(aIndex != -1) {
-		xDebug() << tr("Replacing dependency %1 by alias %2").arg(original.toString(), aliases[aIndex].alias.toString());
-		original = aliases[aIndex].alias;
+	AliasMap map;
+	map.reserve(aliases.size());
+	for(const auto &alias : aliases)
+		map.insert(alias.original, alias);
+	return map;
+}
+
+void Command::replaceAlias(QpmxDependency &original, const AliasMap &aliases)
+{
+	//the map is keyed by provider and package, the version must match as well
+	for(auto it = aliases.constFind(original); it != aliases.constEnd() && it.key() == original; it++) {
+		if(*it == original) {
+			xDebug() << tr("Replacing dependency %1 by alias %2").arg(original.toString(), it->alias.toString());
+			original = it->alias;
+			return;
+		}
 	}
 }
 
@@ -239,13 +570,99 @@ void Command::cleanCaches(const PackageInfo &package, const CacheLock &srcLockRe
 		throw tr("Failed to remove source cache for %1").arg(package.toString());
 	auto bDir = buildDir();
 	for(const auto &cmpDir : bDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::Readable)) {
+		auto _bl = buildLock(cmpDir, QpmxDevDependency{QpmxDependency{package}});
 		auto rDir = buildDir(cmpDir, package);
 		if(!rDir.removeRecursively())
 			throw tr("Failed to remove compilation cache for %1").arg(package.toString());
+		_bl.discard();
 	}
 	xInfo() << tr("Removed cached sources and binaries for %1").arg(package.toString());
 }
 
+void Command::writeArtifactKey(const QDir &buildDir)
+{
+	QFile keyFile{buildDir.absoluteFilePath(QStringLiteral(".qpmx-artifact"))};
+	if(!keyFile.open(QIODevice::WriteOnly) ||
+	   keyFile.write(BuildId{QUuid::createUuid()}.toUtf8()) == -1)
+		throw tr("Failed to write artifact key with error: %1").arg(keyFile.errorString());
+}
+
+QByteArray Command::artifactKey(const QDir &buildDir)
+{
+	QFile keyFile{buildDir.absoluteFilePath(QStringLiteral(".qpmx-artifact"))};
+	if(keyFile.open(QIODevice::ReadOnly))
+		return keyFile.readAll().trimmed();
+
+	//builds of older qpmx versions have no key
+	QFileInfo priInfo{buildDir.absoluteFilePath(QStringLiteral("include.pri"))};
+	if(!priInfo.exists())
+		return {};
+	return QByteArray::number(priInfo.lastModified().toMSecsSinceEpoch()) + '-' + QByteArray::number(priInfo.size());
+}
+
+QString Command::projectArtifacts(const QpmxUserFormat &format, const BuildId &kitId) const
+{
+	//artifact keys of all packages the project resolves to, including the dependencies of dependencies
+	QHash<PackageInfo, QpmxDevDependency> devDeps;
+	for(const auto &dep : format.devDependencies)
+		devDeps.insert(dep.pkg(), dep);
+	auto aliases = aliasMap(format.devAliases);
+
+	QSet<PackageInfo> visited;
+	auto queue = format.allDeps();
+	QStringList entries;
+	while(!queue.isEmpty()) {
+		auto dep = queue.takeFirst();
+		if(visited.contains(dep.pkg()))
+			continue;
+		visited.insert(dep.pkg());
+
+		QpmxFormat depFormat;
+		auto hasSources = false;
+		{
+			auto _rl = pkgReadLock(dep.pkg());
+			auto sDir = srcDir(dep);
+			hasSources = sDir.exists();
+			depFormat = QpmxFormat::readFile(sDir);
+		}
+		entries.append(dep.toString() + QLatin1Char('=') +
+					   (hasSources ? QString::fromUtf8(artifactKey(buildDir(kitId, dep))) : QStringLiteral("-")));
+		for(auto subDep : qAsConst(depFormat.dependencies)) {
+			replaceAlias(subDep, aliases);
+			queue.append(devDeps.value(subDep.pkg(), subDep));
+		}
+	}
+	entries.sort();
+	return entries.join(QLatin1Char('\n'));
+}
+
+bool Command::writeIfChanged(const QString &path, const QByteArray &data, bool text)
+{
+	//identical content keeps the old file and its timestamp, so nothing depending on it gets rebuilt
+	auto mode = text ? QIODevice::Text : QIODevice::NotOpen;
+	QFile oldFile{path};
+	if(oldFile.open(QIODevice::ReadOnly | mode) && oldFile.readAll() == data)
+		return false;
+	oldFile.close();
+
+	QSaveFile saveFile{path};
+	if(!saveFile.open(QIODevice::WriteOnly | mode) ||
+	   saveFile.write(data) != data.size() ||
+	   !saveFile.commit()) {
+		throw tr("Failed to write %1 with error: %2")
+				.arg(QDir::toNativeSeparators(path), saveFile.errorString());
+	}
+	return true;
+}
+
+
+void Command::quit() const
+{
+	//within the daemon a command is done once initialize returns
+	if(!_DaemonMode)
+		qApp->quit();
+}
+
 bool Command::readBool(const QString &message, QTextStream &stream, bool defaultValue) const
 {
 	forever {
@@ -315,6 +732,8 @@ void Command::subCall(QStringList arguments, const QString &workingDir) const
 #endif
 	if(_qmakeRun)
 		arguments.prepend(QStringLiteral("--qmake-run"));
+	arguments.prepend(QString::number(_jobs));
+	arguments.prepend(QStringLiteral("--jobs"));
 
 	xDebug() << tr("Running subcommand with arguments: %1")
 				.arg(arguments.join(QLatin1Char(' ')));
@@ -476,14 +895,27 @@ QDir Command::cacheDir() const
 
 Command::CacheLock Command::lock(const QString &name, bool asDev) const
 {
-	using namespace std::chrono;
+	auto fName = lockDir(asDev).absoluteFilePath(pkgEncode(name) + QStringLiteral(".lock"));
+	return CacheLock{fName, staleTimeout(), lockTimeout()};
+}
 
+Command::SharedCacheLock Command::sharedLock(const QString &name, bool asDev) const
+{
 	auto fName = lockDir(asDev).absoluteFilePath(pkgEncode(name) + QStringLiteral(".lock"));
-	auto staleLock = _settings->value(QStringLiteral("stale-timeout"),
-									  static_cast<int>(duration_cast<milliseconds>(minutes(2)).count()))
-					 .toInt();
+	return SharedCacheLock{fName, staleTimeout(), lockTimeout()};
+}
+
+int Command::lockTimeout() const
+{
+	return _settings->value(QStringLiteral("lock-timeout"), 0).toInt();
+}
 
-	return CacheLock{fName, staleLock};
+int Command::staleTimeout() const
+{
+	using namespace std::chrono;
+	return _settings->value(QStringLiteral("stale-timeout"),
+							static_cast<int>(duration_cast<milliseconds>(minutes(2)).count()))
+			.toInt();
 }
 
 
@@ -495,9 +927,14 @@ Command::CacheLock::CacheLock() :
 
 Command::CacheLock::CacheLock(CacheLock &&mv) noexcept :
 	_path(std::move(mv._path)),
-	_lock(nullptr)
+	_lock(nullptr),
+	_waitTimeout(mv._waitTimeout),
+	_owner(mv._owner)
 {
 	_lock.swap(mv._lock);
+#ifdef Q_OS_UNIX
+	std::swap(_rwFd, mv._rwFd);
+#endif
 }
 
 Command::CacheLock &Command::CacheLock::operator=(Command::CacheLock &&mv) noexcept
@@ -506,12 +943,18 @@ Command::CacheLock &Command::CacheLock::operator=(Command::CacheLock &&mv) noexc
 	free();
 	_path = std::move(mv._path);
 	_lock.swap(mv._lock);
+	_waitTimeout = mv._waitTimeout;
+	_owner = mv._owner;
+#ifdef Q_OS_UNIX
+	std::swap(_rwFd, mv._rwFd);
+#endif
 	return (*this);
 }
 
-Command::CacheLock::CacheLock(const QString &path, int timeout) :
+Command::CacheLock::CacheLock(const QString &path, int timeout, int waitTimeout) :
 	_path(path),
-	_lock(new QLockFile(path))
+	_lock(new QLockFile(path)),
+	_waitTimeout(waitTimeout)
 {
 	if(timeout >= 0)
 		_lock->setStaleLockTime(timeout);
@@ -532,14 +975,32 @@ bool Command::CacheLock::isLocked() const
 
 void Command::CacheLock::free()
 {
+#ifdef Q_OS_UNIX
+	rwUnlock(_rwFd);
+#endif
 	if(_lock) {
 		if(_lock->isLocked()) {
 			_lock->unlock();
+			unregisterLock(_path, _owner);
 			xDebug() << tr("Freed lock %{bld}%1%{end}").arg(_path);
 		}
 	}
 }
 
+void Command::CacheLock::discard()
+{
+	if(!isLocked())
+		return;
+#ifdef Q_OS_UNIX
+	//only safe while locked - waiting processes notice the unlinked files and retry
+	for(const auto &path : {rwGatePath(_path), rwDataPath(_path)}) {
+		if(QFile::exists(path) && !QFile::remove(path))
+			xDebug() << tr("Failed to remove lockfile %{bld}%1%{end}").arg(path);
+	}
+#endif
+	free(); //the lock file itself is removed by unlocking
+}
+
 void Command::CacheLock::relock()
 {
 	if(_lock) {
@@ -552,7 +1013,35 @@ void Command::CacheLock::relock()
 
 void Command::CacheLock::doLock()
 {
-	if(!_lock->lock()) {
+	_owner = registerLock(_path, true);
+	try {
+		lockFiles();
+	} catch(...) {
+		unregisterLock(_path, _owner);
+		throw;
+	}
+}
+
+void Command::CacheLock::lockFiles()
+{
+	LockWaiter waiter{_path, _waitTimeout};
+	auto holder = [this]() -> QString {
+		qint64 pid;
+		QString hostname;
+		QString appname;
+		if(_lock->getLockInfo(&pid, &hostname, &appname))
+			return tr("%1 (P-ID %2 on %3)").arg(appname).arg(pid).arg(hostname);
+		else
+			return {};
+	};
+
+	auto locked = _lock->tryLock(0);
+	while(!locked &&
+		  _lock->error() == QLockFile::LockFailedError &&
+		  waiter.next(holder))
+		locked = _lock->tryLock(0);
+
+	if(!locked) {
 		QString errorStr;
 		switch (_lock->error()) {
 		case QLockFile::NoError:
@@ -560,7 +1049,7 @@ void Command::CacheLock::doLock()
 			errorStr = tr("Unknown lock error occured!");
 			break;
 		case QLockFile::LockFailedError:
-			errorStr = tr("Failed to aquire lock -  already locked by another process.");
+			errorStr = tr("Failed to aquire lock -  already locked by another process. %1").arg(waiter.timeoutError());
 			break;
 		case QLockFile::PermissionError:
 			errorStr = tr("No permission to create lockfile!");
@@ -585,4 +1074,331 @@ void Command::CacheLock::doLock()
 		throw tr("Lockfile-error on file %{bld}%1%{end}: %2")
 				.arg(_path, errorStr);
 	}
+
+#ifdef Q_OS_UNIX
+	//writers also exclude shared readers
+	try {
+		_rwFd = rwLock(_path, true, waiter);
+	} catch(...) {
+		_lock->unlock();
+		throw;
+	}
+#endif
+}
+
+
+
+Command::SharedCacheLock::SharedCacheLock() :
+	_path()
+{}
+
+Command::SharedCacheLock::SharedCacheLock(SharedCacheLock &&mv) noexcept :
+	_path(std::move(mv._path)),
+	_owner(mv._owner)
+{
+#ifdef Q_OS_UNIX
+	std::swap(_fd, mv._fd);
+#else
+	_lock = std::move(mv._lock);
+#endif
+}
+
+Command::SharedCacheLock &Command::SharedCacheLock::operator=(SharedCacheLock &&mv) noexcept
+{
+	free();
+	_path = std::move(mv._path);
+	_owner = mv._owner;
+#ifdef Q_OS_UNIX
+	std::swap(_fd, mv._fd);
+#else
+	_lock = std::move(mv._lock);
+#endif
+	return (*this);
+}
+
+Command::SharedCacheLock::SharedCacheLock(const QString &path, int timeout, int waitTimeout) :
+	_path(path)
+{
+#ifdef Q_OS_UNIX
+	Q_UNUSED(timeout)
+	_owner = registerLock(path, false);
+	try {
+		LockWaiter waiter{path, waitTimeout};
+		_fd = rwLock(path, false, waiter);
+	} catch(...) {
+		unregisterLock(path, _owner);
+		throw;
+	}
+#else
+	//no shared locks available -> fall back to exclusive ones
+	_lock = CacheLock{path, timeout, waitTimeout};
+#endif
+	xDebug() << tr("Created shared lock %{bld}%1%{end}").arg(path);
+}
+
+Command::SharedCacheLock::~SharedCacheLock()
+{
+	free();
+}
+
+bool Command::SharedCacheLock::isLocked() const
+{
+#ifdef Q_OS_UNIX
+	return _fd != -1;
+#else
+	return _lock.isLocked();
+#endif
+}
+
+void Command::SharedCacheLock::free()
+{
+	if(!isLocked())
+		return;
+#ifdef Q_OS_UNIX
+	rwUnlock(_fd);
+	unregisterLock(_path, _owner);
+#else
+	_lock.free();
+#endif
+	xDebug() << tr("Freed shared lock %{bld}%1%{end}").arg(_path);
+}
+
+
+
+// slots are shared by all task groups of a command, so nested groups do not multiply the limits
+struct Command::TaskPool
+{
+	struct Waiter {
+		QString provider;
+		QtCoroutine::RoutineId routine;
+		const void *group;
+	};
+
+	int globalLimit;
+	int providerLimit;
+
+	int running = 0;
+	QHash<QString, int> providerLoad;
+	QHash<QtCoroutine::RoutineId, QString> holders;
+	QList<Waiter> queue;
+
+	bool canStart(const QString &provider) const;
+	bool acquire(const QString &provider, const void *group);
+	void reserve(const QString &provider, QtCoroutine::RoutineId routine);
+	void release(QtCoroutine::RoutineId routine);
+	void dropQueued(const void *group);
+};
+
+struct Command::TaskGroup::State
+{
+	QSharedPointer<TaskPool> pool;
+	Canceler canceler;
+	int timeout;
+
+	int pending = 0;
+	quint64 nextId = 0;
+	QHash<quint64, QPair<QString, QtCoroutine::RoutineId>> active;
+	QSet<QString> abandoned;
+
+	bool waiting = false;
+	QtCoroutine::RoutineId waiter = 0;
+	bool canceled = false;
+	std::exception_ptr error;
+
+	void finish();
+	void wake();
+	void setError(std::exception_ptr exception);
+};
+
+Command::TaskGroup::TaskGroup(const Command *command, const Canceler &canceler) :
+	d(QSharedPointer<State>::create())
+{
+	if(!command->_taskPool) {
+		command->_taskPool = QSharedPointer<TaskPool>::create();
+		command->_taskPool->globalLimit = command->_jobs;
+		command->_taskPool->providerLimit = qMax(1, command->settings()->value(QStringLiteral("jobs-per-provider"), command->_jobs).toInt());
+	}
+	d->pool = command->_taskPool;
+	if(canceler) {
+		d->canceler = canceler;
+		d->timeout = 0;
+	} else {
+		auto registry = command->registry();
+		d->canceler = [registry](const QString &provider) {
+			registry->sourcePlugin(provider)->cancelAll(2500);
+		};
+		d->timeout = command->settings()->value(QStringLiteral("task-timeout"), 0).toInt();
+	}
+}
+
+int Command::TaskGroup::providerLimit() const
+{
+	return qMin(d->pool->globalLimit, d->pool->providerLimit);
+}
+
+void Command::TaskGroup::run(const QString &provider, const std::function<void()> &task)
+{
+	auto state = d;
+	++state->pending;
+	QtCoroutine::createAndRun([state, provider, task](){
+		auto routine = QtCoroutine::current();
+		if(state->canceled || !state->pool->acquire(provider, state.data())) {
+			state->finish();
+			return;
+		}
+		if(state->canceled) {
+			state->pool->release(routine);
+			state->finish();
+			return;
+		}
+
+		auto taskId = state->nextId++;
+		state->active.insert(taskId, {provider, routine});
+		if(state->timeout > 0) {
+			QTimer::singleShot(state->timeout, [state, taskId, provider](){
+				if(state->active.contains(taskId))
+					state->setError(std::make_exception_ptr(tr("Operation for provider %{bld}%1%{end} timed out").arg(provider)));
+			});
+		}
+
+		try {
+			task();
+		} catch(...) {
+			state->setError(std::current_exception());
+		}
+
+		//a canceled task still owns its slot until it actually returned
+		state->active.remove(taskId);
+		state->pool->release(routine);
+		state->finish();
+	});
+}
+
+void Command::TaskGroup::wait()
+{
+	//a task waiting for a nested group gives up it's slot meanwhile, else the nested tasks could never start
+	auto routine = QtCoroutine::current();
+	auto heldSlot = d->pool->holders.contains(routine);
+	auto heldProvider = d->pool->holders.value(routine);
+	if(heldSlot)
+		d->pool->release(routine);
+
+	//after an error, running tasks are still waiting for their provider - stop them and wait until they returned
+	forever {
+		for(const auto &provider : qAsConst(d->abandoned))
+			d->canceler(provider);
+		d->abandoned.clear();
+
+		if(d->pending == 0)
+			break;
+		d->waiter = routine;
+		d->waiting = true;
+		QtCoroutine::yield();
+	}
+
+	if(heldSlot)
+		d->pool->acquire(heldProvider, nullptr);
+
+	if(d->error) {
+		auto error = d->error;
+		d->error = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+bool Command::TaskPool::canStart(const QString &provider) const
+{
+	return running < globalLimit &&
+			providerLoad.value(provider) < providerLimit;
+}
+
+bool Command::TaskPool::acquire(const QString &provider, const void *group)
+{
+	auto routine = QtCoroutine::current();
+	if(canStart(provider)) {
+		reserve(provider, routine);
+		return true;
+	}
+
+	//slot is reserved by the task that resumes this one - unless the group got canceled
+	queue.append({provider, routine, group});
+	QtCoroutine::yield();
+	return holders.contains(routine);
+}
+
+void Command::TaskPool::reserve(const QString &provider, QtCoroutine::RoutineId routine)
+{
+	++running;
+	++providerLoad[provider];
+	holders.insert(routine, provider);
+}
+
+void Command::TaskPool::release(QtCoroutine::RoutineId routine)
+{
+	if(!holders.contains(routine))
+		return;
+	auto provider = holders.take(routine);
+	--running;
+	--providerLoad[provider];
+
+	forever {
+		auto index = -1;
+		for(auto i = 0; i < queue.size(); i++) {
+			if(canStart(queue[i].provider)) {
+				index = i;
+				break;
+			}
+		}
+		if(index == -1)
+			break;
+
+		auto next = queue.takeAt(index);
+		reserve(next.provider, next.routine);
+		QtCoroutine::resume(next.routine);
+	}
+}
+
+void Command::TaskPool::dropQueued(const void *group)
+{
+	QList<QtCoroutine::RoutineId> dropped;
+	for(auto it = queue.begin(); it != queue.end();) {
+		if(it->group == group) {
+			dropped.append(it->routine);
+			it = queue.erase(it);
+		} else
+			it++;
+	}
+	for(auto routine : dropped)
+		QtCoroutine::resume(routine);
+}
+
+void Command::TaskGroup::State::finish()
+{
+	--pending;
+	if(pending == 0)
+		wake();
+}
+
+void Command::TaskGroup::State::wake()
+{
+	if(waiting) {
+		waiting = false;
+		QtCoroutine::resume(waiter);
+	}
+}
+
+void Command::TaskGroup::State::setError(std::exception_ptr exception)
+{
+	//keep the first error, skip all tasks that did not start yet and let the waiter cancel the running ones
+	if(!error)
+		error = exception;
+	if(canceled)
+		return;
+	canceled = true;
+
+	pool->dropQueued(this);
+	for(const auto &task : qAsConst(active))
+		abandoned.insert(task.first);
+	if(!abandoned.isEmpty())
+		wake();
 }
@@ -8,6 +8,9 @@
 #include <QUuid>
 #include <QSettings>
 #include <QLockFile>
+#include <QSharedPointer>
+#include <functional>
+#include <qtcoroutine.h>
 
 #include "packageinfo.h"
 #include "pluginregistry.h"
@@ -35,9 +38,12 @@ public:
 	static void setupParser(QCliParser &parser, const QHash<QString, Command*> &commands);
 
 	void init(QCliParser &parser);
+	void setupFrom(const Command &other);
 	void fin();
 
 	static int exitCode();
+	static bool failed();
+	static void markFailed();
 	static QDir subDir(QDir dir, const QString &provider, const QString &package, const QVersionNumber &version, bool mkDir);
 
 protected slots:
@@ -46,6 +52,10 @@ protected slots:
 
 protected:
 	static int _ExitCode;
+	static bool _Failed;
+	static bool _DaemonMode;
+
+	static void resetStats();
 
 	struct BuildId : public QString
 	{
@@ -65,6 +75,8 @@ protected:
 #endif
 	};
 
+	class SharedCacheLock;
+
 	class CacheLock
 	{
 		friend class Command;
@@ -80,13 +92,64 @@ protected:
 		bool isLocked() const;
 		void free();
 		void relock();
+		void discard();
 
 	private:
-		CacheLock(const QString &path, int timeout);
+		CacheLock(const QString &path, int timeout, int waitTimeout);
 		QString _path;
 		QScopedPointer<QLockFile> _lock;
+		int _waitTimeout = 0;
+		QtCoroutine::RoutineId _owner = 0;
+#ifdef Q_OS_UNIX
+		int _rwFd = -1;
+#endif
 
 		void doLock();
+		void lockFiles();
+	};
+
+	class SharedCacheLock
+	{
+		friend class Command;
+		Q_DISABLE_COPY(SharedCacheLock)
+
+	public:
+		SharedCacheLock();
+		SharedCacheLock(SharedCacheLock &&mv) noexcept;
+		SharedCacheLock &operator=(SharedCacheLock &&mv) noexcept;
+		~SharedCacheLock();
+
+		bool isLocked() const;
+		void free();
+
+	private:
+		SharedCacheLock(const QString &path, int timeout, int waitTimeout);
+		QString _path;
+		QtCoroutine::RoutineId _owner = 0;
+#ifdef Q_OS_UNIX
+		int _fd = -1;
+#else
+		CacheLock _lock;
+#endif
+	};
+
+	class TaskGroup
+	{
+		Q_DISABLE_COPY(TaskGroup)
+
+	public:
+		//tasks of a group with an own canceler are no provider operations and never time out
+		using Canceler = std::function<void(const QString &provider)>;
+		explicit TaskGroup(const Command *command, const Canceler &canceler = {});
+
+		int providerLimit() const;
+
+		void run(const QString &provider, const std::function<void()> &task);
+		void wait();
+
+	private:
+		struct State;
+		QSharedPointer<State> d;
 	};
 
 	PluginRegistry *registry() const;
@@ -98,15 +161,28 @@ protected:
 	Q_REQUIRED_RESULT CacheLock pkgLock(const qpmx::PackageInfo &package) const;
 	Q_REQUIRED_RESULT CacheLock pkgLock(const QpmxDependency &dep) const;
 	Q_REQUIRED_RESULT CacheLock pkgLock(const QpmxDevDependency &dep) const;
+	Q_REQUIRED_RESULT SharedCacheLock pkgReadLock(const qpmx::PackageInfo &package) const;
+	Q_REQUIRED_RESULT SharedCacheLock pkgReadLock(const QpmxDevDependency &dep) const;
+	Q_REQUIRED_RESULT CacheLock buildLock(const BuildId &kitId, const QpmxDevDependency &dep) const;
 	Q_REQUIRED_RESULT CacheLock kitLock() const;
+	Q_REQUIRED_RESULT SharedCacheLock kitReadLock() const;
+	Q_REQUIRED_RESULT CacheLock initLock(const QString &projectKey) const;
+	Q_REQUIRED_RESULT CacheLock searchIndexLock() const;
 
 	QList<qpmx::PackageInfo> readCliPackages(const QStringList &arguments, bool fullPkgOnly = false) const;
 	static QList<QpmxDependency> depList(const QList<qpmx::PackageInfo> &pkgList);
 	static QList<QpmxDevDependency> devDepList(const QList<qpmx::PackageInfo> &pkgList);
-	static void replaceAlias(QpmxDependency &original, const QList<QpmxDevAlias> &aliases);
+	using AliasMap = QMultiHash<QpmxDependency, QpmxDevAlias>;
+	static AliasMap aliasMap(const QList<QpmxDevAlias> &aliases);
+	static void replaceAlias(QpmxDependency &original, const AliasMap &aliases);
 
 	void cleanCaches(const qpmx::PackageInfo &package, const CacheLock &srcLockRef) const;
+	static void writeArtifactKey(const QDir &buildDir);
+	static QByteArray artifactKey(const QDir &buildDir);
+	QString projectArtifacts(const QpmxUserFormat &format, const BuildId &kitId) const;
+	static bool writeIfChanged(const QString &path, const QByteArray &data, bool text = true);
 
+	void quit() const;
 	bool readBool(const QString &message, QTextStream &stream, bool defaultValue) const;
 	void printTable(const QStringList &headers, const QList<int> &minimals, const QList<QStringList> &rows) const;
 	void subCall(QStringList arguments, const QString &workingDir = {}) const;
@@ -125,6 +201,7 @@ protected:
 
 	QDir tmpDir() const;
 	QDir lockDir(bool asDev) const;
+	QDir cacheDir() const;
 
 	static QString pkgEncode(const QString &name);
 	static QString pkgDecode(QString name);
@@ -144,9 +221,14 @@ private:
 #endif
 	bool _qmakeRun = false;
 	QString _cacheDir;
+	int _jobs = 5;
+	struct TaskPool;
+	mutable QSharedPointer<TaskPool> _taskPool;
 
-	QDir cacheDir() const;
 	Q_REQUIRED_RESULT CacheLock lock(const QString &name, bool asDev = false) const;
+	Q_REQUIRED_RESULT SharedCacheLock sharedLock(const QString &name, bool asDev = false) const;
+	int staleTimeout() const;
+	int lockTimeout() const;
 };
 
 #define xDebug(...) qDebug(__VA_ARGS__).noquote()
@@ -4,14 +4,105 @@
 
 #include <QCryptographicHash>
 #include <QDirIterator>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
 #include <QProcess>
 #include <QQueue>
+#include <QSet>
 #include <QStandardPaths>
 #include <QUrl>
 
 #include <qtcoawaitables.h>
+#if defined(Q_OS_LINUX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#elif defined(Q_OS_MACOS)
+#include <stdio.h>
+#endif
 using namespace qpmx;
 
+namespace {
+
+// swaps two existing directories in one step, so readers always see one of them
+bool exchangeDirs(const QString &lhs, const QString &rhs)
+{
+	auto lhsPath = QFile::encodeName(lhs);
+	auto rhsPath = QFile::encodeName(rhs);
+#if defined(Q_OS_LINUX) && defined(SYS_renameat2) && defined(RENAME_EXCHANGE)
+	return ::syscall(SYS_renameat2, AT_FDCWD, lhsPath.constData(), AT_FDCWD, rhsPath.constData(), RENAME_EXCHANGE) == 0;
+#elif defined(Q_OS_MACOS) && defined(RENAME_SWAP)
+	return ::renamex_np(lhsPath.constData(), rhsPath.constData(), RENAME_SWAP) == 0;
+#else
+	Q_UNUSED(lhsPath)
+	Q_UNUSED(rhsPath)
+	return false;
+#endif
+}
+
+// rcc files of all packages end up in one directory when deployed, so their names must be unique
+QString rccPrefix(const QpmxDevDependency &dep)
+{
+	return QString{dep.package}.replace(QRegularExpression{QStringLiteral("[^a-zA-Z0-9]")}, QStringLiteral("_")) + QLatin1Char('_');
+}
+
+// the kit registry is cached per process and reloaded once qt-kits.ini changes
+struct KitRegistry {
+	qint64 modified;
+	qint64 size;
+	QList<QtKitInfo> kits;
+	QHash<QString, QUuid> ids;
+};
+
+QMutex kitRegistryLock;
+QHash<QString, KitRegistry> kitRegistries;
+
+KitRegistry loadKitRegistry(const QDir &buildDir)
+{
+	auto path = buildDir.absoluteFilePath(QStringLiteral("qt-kits.ini"));
+	QFileInfo info{path};
+	auto modified = info.exists() ? info.lastModified().toMSecsSinceEpoch() : -1;
+	auto size = info.exists() ? info.size() : -1;
+
+	QMutexLocker _{&kitRegistryLock};
+	auto it = kitRegistries.constFind(path);
+	if(it != kitRegistries.constEnd() &&
+	   it->modified == modified &&
+	   it->size == size)
+		return *it;
+
+	KitRegistry registry{modified, size, {}, {}};
+	QSettings settings{path, QSettings::IniFormat};
+	auto kitCnt = settings.beginReadArray(QStringLiteral("qt-kits"));
+	registry.kits.reserve(kitCnt);
+	registry.ids.reserve(kitCnt);
+	for(auto i = 0; i < kitCnt; i++) {
+		settings.setArrayIndex(i);
+		QtKitInfo info;
+		info.id = settings.value(QStringLiteral("id"), info.id).toUuid();
+		info.path = settings.value(QStringLiteral("path"), info.path).toString();
+		info.qmakeVer = settings.value(QStringLiteral("qmakeVer"), QVariant::fromValue(info.qmakeVer)).value<QVersionNumber>();
+		info.qtVer = settings.value(QStringLiteral("qtVer"), QVariant::fromValue(info.qtVer)).value<QVersionNumber>();
+		info.spec = settings.value(QStringLiteral("spec"), info.spec).toString();
+		info.xspec = settings.value(QStringLiteral("xspec"), info.xspec).toString();
+		info.hostPrefix = settings.value(QStringLiteral("hostPrefix"), info.hostPrefix).toString();
+		info.installPrefix = settings.value(QStringLiteral("installPrefix"), info.installPrefix).toString();
+		info.sysRoot = settings.value(QStringLiteral("sysRoot"), info.sysRoot).toString();
+		registry.kits.append(info);
+		if(!registry.ids.contains(info.path))
+			registry.ids.insert(info.path, info.id);
+	}
+	settings.endArray();
+
+	kitRegistries.insert(path, registry);
+	return registry;
+}
+
+}
+
 CompileCommand::CompileCommand(QObject *parent) :
 	Command{parent}
 {}
@@ -101,290 +192,459 @@ void CompileCommand::initialize(QCliParser &parser)
 			}
 			if(_pkgList.isEmpty()) {
 				xInfo() << tr("No globally cached packages found. Nothing will be done");
-				qApp->quit();
+				quit();
 				return;
 			}
 			xDebug() << tr("Compiling all %n globally cached package(s)", "", _pkgList.size());
-		} else {
-			auto format = QpmxUserFormat::readDefault(true);
-			if(format.source) {
-				xInfo() << tr("qpmx.json has the sources flag set. No binaries will be compiled");
-				qApp->quit();
-				return;
-			}
-
-			_pkgList = format.allDeps();
-			_aliases = format.devAliases;
-			if(_pkgList.isEmpty()) {
-				xWarning() << tr("No packages to compile found in qpmx.json. Nothing will be done");
-				qApp->quit();
-				return;
-			}
-			if(format.hasDevOptions())
-				setDevMode(true);
-
-			xDebug() << tr("Compiling %n package(s) from qpmx.json file", "", _pkgList.size());
+		} else if(!loadProject()) {
+			quit();
+			return;
 		}
 
-		//collect all dependencies
-		depCollect();
-		//setup environment and qt kits
-#ifndef QPMX_NO_MAKEBUG
-		setupEnv();
-#endif
-		initKits(parser.values(QStringLiteral("qmake")));
-		// start compiling
-		compilePackages();
+		compileAll(parser.values(QStringLiteral("qmake")));
+		quit();
 	} catch(QString &s) {
 		xCritical() << s;
 	}
 }
 
+void CompileCommand::compileProject(const QString &qmake, bool recompile, bool fwdStderr, bool clean)
+{
+	_recompile = recompile;
+	_fwdStderr = fwdStderr;
+	_clean = clean;
+	if(loadProject())
+		compileAll({qmake});
+}
+
 void CompileCommand::finalize()
 {
-	if(_process) {
-		_process->terminate();
-		if(!_process->waitForFinished(2500)) {
-			_process->kill();
-			_process->waitForFinished(100);
-		}
+	terminateProcesses();
+}
+
+bool CompileCommand::loadProject()
+{
+	auto format = QpmxUserFormat::readDefault(true);
+	if(format.source) {
+		xInfo() << tr("qpmx.json has the sources flag set. No binaries will be compiled");
+		return false;
 	}
+
+	_pkgList = format.allDeps();
+	_aliases = aliasMap(format.devAliases);
+	if(_pkgList.isEmpty()) {
+		xWarning() << tr("No packages to compile found in qpmx.json. Nothing will be done");
+		return false;
+	}
+	if(format.hasDevOptions())
+		setDevMode(true);
+
+	xDebug() << tr("Compiling %n package(s) from qpmx.json file", "", _pkgList.size());
+	return true;
 }
 
-void CompileCommand::compilePackages()
+void CompileCommand::compileAll(const QStringList &qmakes)
 {
-	for(const auto &current : _pkgList) {
-		auto lock = pkgLock(current);
-		for(const auto &kit : _qtKits) {
-			//check if include.pri exists
-			auto bDir = buildDir(kit.id, current);
-			if(bDir.exists()) {
-				if(current.isDev() || //always recompile dev deps
-				   !bDir.exists(QStringLiteral("include.pri")) || //no include.pri -> invalid -> delete and recompile
-				   (_recompile && _explicitPkg.contains(current))) { //only recompile explicitly specified (which is all except if passing as arguments)
-					xInfo() << tr("Recompiling package %1 with qmake \"%2\"")
-							   .arg(current.toString(), kit.path);
-					if(!bDir.removeRecursively()) {
-						throw tr("Failed to remove previous build of %1 with \"%2\"")
-						.arg(current.toString(), kit.path);
-					}
-					xDebug() << tr("Removed previous build of %1 with \"%2\"")
-								.arg(current.toString(), kit.path);
-				} else {
-					xDebug() << tr("Package %1 already has compiled binaries for \"%2\"")
-								.arg(current.toString(), kit.path);
-					continue;
-				}
-			} else {
-				xInfo() << tr("Compiling package %1 with qmake \"%2\"")
-						   .arg(current.toString(), kit.path);
-			}
+	//collect all dependencies
+	depCollect();
+	//setup environment and qt kits
+#ifndef QPMX_NO_MAKEBUG
+	setupEnv();
+#endif
+	initKits(qmakes);
+	// start compiling
+	compilePackages();
+}
 
-			//prepare build vars, create temp dir and load qpmx.json
-			_current = current;
-			_kit = kit;
-			if(current.isDev() && !_clean)
-				_compileDir.reset(new BuildDir(buildDir(QStringLiteral("build"), current, true)));
-			else
-				_compileDir.reset(new BuildDir());
-			_compileDir->setAutoRemove(false);
-
-			_format = QpmxFormat::readFile(srcDir(current), true);
-			if(_format.source)
-				xWarning() << tr("Compiling a source-only package %1. This can lead to unexpected behaviour").arg(current.toString());
-
-			//make steps
-			xDebug() << tr("Setting up build via qmake");
-			qmake();
-			xDebug() << tr("Completed setup. Continuing with compile (make)");
-			make();
-			xDebug() << tr("Completed compile. Installing to cache directory");
-			install();
-			priGen();
-			xDebug() << tr("Completed installation. Compliation succeeded");
-
-			_compileDir->setAutoRemove(true);
-			_compileDir.reset();
+void CompileCommand::compilePackages()
+{
+	//the packages of one level only depend on lower levels, so they are compiled in parallel
+	for(const auto &level : qAsConst(_pkgLevels)) {
+		TaskGroup group{this, [this](const QString &) {
+			terminateProcesses();
+		}};
+		for(const auto &current : level) {
+			group.run(QStringLiteral("compile"), [this, current](){
+				compilePackage(current);
+			});
 		}
+		group.wait();
 	}
 
 	xDebug() << tr("Package compilation completed");
-	qApp->quit();
 }
 
-void CompileCommand::qmake()
+void CompileCommand::compilePackage(const QpmxDevDependency &current)
+{
+	//the sources are only read, builds for different kits are locked separately
+	auto _sl = pkgReadLock(current);
+	//dev builds share one build directory for all kits
+	CacheLock _dl;
+	if(current.isDev() && !_clean)
+		_dl = buildLock(QStringLiteral("build"), current);
+	for(const auto &kit : _qtKits) {
+		auto _bl = buildLock(kit.id, current);
+		//check if include.pri exists
+		auto bDir = buildDir(kit.id, current);
+		if(bDir.exists()) {
+			if(current.isDev() || //always recompile dev deps
+			   !bDir.exists(QStringLiteral("include.pri")) || //no include.pri -> invalid -> delete and recompile
+			   (_recompile && _explicitPkg.contains(current))) { //only recompile explicitly specified (which is all except if passing as arguments)
+				//the previous build stays visible until the new one gets published
+				xInfo() << tr("Recompiling package %1 with qmake \"%2\"")
+						   .arg(current.toString(), kit.path);
+			} else {
+				xDebug() << tr("Package %1 already has compiled binaries for \"%2\"")
+							.arg(current.toString(), kit.path);
+				continue;
+			}
+		} else {
+			xInfo() << tr("Compiling package %1 with qmake \"%2\"")
+					   .arg(current.toString(), kit.path);
+		}
+
+		//prepare build vars, create temp dir and load qpmx.json
+		Build build;
+		build.current = current;
+		build.kit = kit;
+		if(current.isDev() && !_clean)
+			build.compileDir.reset(new BuildDir(buildDir(QStringLiteral("build"), current, true)));
+		else
+			build.compileDir.reset(new BuildDir());
+		build.compileDir->setAutoRemove(false);
+		build.stageDir.reset(new QTemporaryDir(stageDir(kit.id).absoluteFilePath(QStringLiteral("stage.XXXXXX"))));
+		if(!build.stageDir->isValid())
+			throw tr("Failed to create staging directory with error: %1").arg(build.stageDir->errorString());
+
+		build.format = QpmxFormat::readFile(srcDir(current), true);
+		if(build.format.source)
+			xWarning() << tr("Compiling a source-only package %1. This can lead to unexpected behaviour").arg(current.toString());
+
+		//make steps
+		xDebug() << tr("Setting up build via qmake");
+		qmake(build);
+		xDebug() << tr("Completed setup. Continuing with compile (make)");
+		make(build);
+		xDebug() << tr("Completed compile. Installing to cache directory");
+		install(build);
+		priGen(build);
+		publish(build);
+		xDebug() << tr("Completed installation. Compliation succeeded");
+
+		build.compileDir->setAutoRemove(true);
+	}
+}
+
+void CompileCommand::qmake(Build &build)
 {
 	// create pro file
-	auto priBase = QFileInfo(_format.priFile).completeBaseName();
-	auto proFile = _compileDir->filePath(QStringLiteral("static.pro"));
+	auto priBase = QFileInfo(build.format.priFile).completeBaseName();
+	auto proFile = build.compileDir->filePath(QStringLiteral("static.pro"));
 
 	//cleanup (in case of dev build) - no error check on purpose
-	QFile::remove(proFile);
-	QFile::remove(_compileDir->filePath(QStringLiteral(".qpmx_resources")));
-	QFile::remove(_compileDir->filePath(QStringLiteral(".no_sources_detected")));
+	QFile::remove(build.compileDir->filePath(QStringLiteral(".qpmx_resources")));
+	QFile::remove(build.compileDir->filePath(QStringLiteral(".qpmx_external_resources")));
+	QFile::remove(build.compileDir->filePath(QStringLiteral(".no_sources_detected")));
 	//keep hooks file, will be regenerated on changes
 
-	if(!QFile::copy(QStringLiteral(":/build/template_static.pro"), proFile))
+	//pro and conf files are only replaced on changes, so a dev build does not rebuild everything
+	QFile proTemplate(QStringLiteral(":/build/template_static.pro"));
+	if(!proTemplate.open(QIODevice::ReadOnly | QIODevice::Text))
 		throw tr("Failed to create compilation pro file");
-	QFile::setPermissions(proFile, QFile::permissions(proFile) | QFile::WriteUser);
-	auto bDir = buildDir(_kit.id, _current, true);
+	writeIfChanged(proFile, proTemplate.readAll());
+	proTemplate.close();
 
 	//create qmake.conf file
-	QFile confFile(_compileDir->filePath(QStringLiteral(".qmake.conf")));
-	if(!confFile.open(QIODevice::WriteOnly | QIODevice::Text))
-		throw tr("Failed to create qmake config with error: %1").arg(confFile.errorString());
-	QTextStream stream(&confFile);
+	QByteArray confData;
+	QTextStream stream(&confData);
 	stream << "QPMX_TARGET = " << priBase << "\n"
-		   << "QPMX_VERSION = " << _current.version.toString() << "\n"
-		   << "QPMX_PRI_INCLUDE = \"" << srcDir(_current).absoluteFilePath(_format.priFile) << "\"\n"
-		   << "QPMX_INSTALL = \"" << bDir.absolutePath() << "\"\n"
+		   << "QPMX_VERSION = " << build.current.version.toString() << "\n"
+		   << "QPMX_PRI_INCLUDE = \"" << srcDir(build.current).absoluteFilePath(build.format.priFile) << "\"\n"
+		   << "QPMX_INSTALL = \"" << build.stageDir->path() << "\"\n"
 		   << "QPMX_BIN = \"" << QDir::toNativeSeparators(QCoreApplication::applicationFilePath()) << "\"\n"
-		   << "TS_TMP = $$TRANSLATIONS\n\n";
-	for(auto dep : qAsConst(_format.dependencies)) {
+		   << "TS_TMP = $$TRANSLATIONS\n";
+	if(build.format.externalResources)
+		stream << "QPMX_EXTERNAL_RESOURCES = 1\n"
+			   << "QPMX_RCC_PREFIX = " << rccPrefix(build.current) << "\n";
+	stream << "\n";
+	for(auto dep : qAsConst(build.format.dependencies)) {
 		// replace alias
 		replaceAlias(dep, _aliases);
 		// add dep
-		auto depDir = buildDir(_kit.id, dep);
+		auto depDir = buildDir(build.kit.id, dep);
 		stream << "include(" << depDir.absoluteFilePath(QStringLiteral("include.pri")) << ")\n";
 	}
 	stream << "\nTRANSLATIONS = $$TS_TMP\n";
 
 	stream.flush();
-	confFile.close();
+	writeIfChanged(build.compileDir->filePath(QStringLiteral(".qmake.conf")), confData);
 
-	initProcess(_kit.path, QStringLiteral("qmake"));
+	initProcess(build, build.kit.path, QStringLiteral("qmake"));
 	QStringList args;
 	args.append(proFile);
-	_process->setArguments(args);
-	if(QtCoroutine::await(_process) != EXIT_SUCCESS)
-		raiseError(QStringLiteral("qmake"));
+	build.process->setArguments(args);
+	if(QtCoroutine::await(build.process.data()) != EXIT_SUCCESS)
+		raiseError(build, QStringLiteral("qmake"));
 }
 
-void CompileCommand::make()
+void CompileCommand::make(Build &build)
 {
 	//check if anything is to be compiled
-	if(QFile::exists(_compileDir->filePath(QStringLiteral(".no_sources_detected")))) {
+	if(QFile::exists(build.compileDir->filePath(QStringLiteral(".no_sources_detected")))) {
 		//skip to the install step, and cache information for generatePri
 		xDebug() << tr("No sources to compile detected. skipping make step");
-		_hasBinary = false;
+		build.hasBinary = false;
 	} else {
-		_hasBinary = true;
+		build.hasBinary = true;
 		//just run make
-		initProcess(findMake(), QStringLiteral("make"));
-		_process->setArguments({QStringLiteral("all")});
-		if(QtCoroutine::await(_process) != EXIT_SUCCESS)
-			raiseError(QStringLiteral("make"));
+		initProcess(build, findMake(build), QStringLiteral("make"));
+		build.process->setArguments({QStringLiteral("all")});
+		if(QtCoroutine::await(build.process.data()) != EXIT_SUCCESS)
+			raiseError(build, QStringLiteral("make"));
 	}
 }
 
-void CompileCommand::install()
+void CompileCommand::install(Build &build)
 {
 	//just run make install
-	initProcess(findMake(), QStringLiteral("install"));
-	_process->setProgram(findMake());
-	_process->setArguments({QStringLiteral("all-install")});
-	if(QtCoroutine::await(_process) != EXIT_SUCCESS)
-		raiseError(QStringLiteral("install"));
+	initProcess(build, findMake(build), QStringLiteral("install"));
+	build.process->setProgram(findMake(build));
+	build.process->setArguments({QStringLiteral("all-install")});
+	if(QtCoroutine::await(build.process.data()) != EXIT_SUCCESS)
+		raiseError(build, QStringLiteral("install"));
 }
 
-void CompileCommand::priGen()
+void CompileCommand::priGen(Build &build)
 {
-	auto bDir = buildDir(_kit.id, _current, true);
+	//relative paths are relative to the final location, not the staging directory
+	auto bDir = buildDir(build.kit.id, build.current);
 
 	//create include.pri file
-	QFile metaFile(bDir.absoluteFilePath(QStringLiteral("include.pri")));
-	if(!metaFile.open(QIODevice::WriteOnly | QIODevice::Text))
-		throw tr("Failed to create meta.pri with error: %1").arg(metaFile.errorString());
-	auto libName = QFileInfo(_format.priFile).completeBaseName();
-	QTextStream stream(&metaFile);
-	stream << "!contains(QPMX_INCLUDE_GUARDS, \"" << _current.package << "\") {\n"
-		   << "\tQPMX_INCLUDE_GUARDS += \"" << _current.package << "\"\n\n";
+	QByteArray priData;
+	auto libName = QFileInfo(build.format.priFile).completeBaseName();
+	QTextStream stream(&priData);
+	stream << "!contains(QPMX_INCLUDE_GUARDS, \"" << build.current.package << "\") {\n"
+		   << "\tQPMX_INCLUDE_GUARDS += \"" << build.current.package << "\"\n\n";
 	stream << "\t#dependencies\n";
-	for(auto dep : qAsConst(_format.dependencies)) {
+	for(auto dep : qAsConst(build.format.dependencies)) {
 		// replace aliases
 		replaceAlias(dep, _aliases);
 		// add dep
-		auto depDir = buildDir(_kit.id, dep);
+		auto depDir = buildDir(build.kit.id, dep);
 		stream << "\tinclude(" << bDir.relativeFilePath(depDir.absoluteFilePath(QStringLiteral("include.pri"))) << ")\n";
 	}
 	stream << "\n\t#includes\n"
 		   << "\tINCLUDEPATH += \"$$PWD/include\"\n"
 		   << "\texists($$PWD/translations): QPMX_TS_DIRS += \"$$PWD/translations\"\n";
-	if(_hasBinary) {
-		stream << "\n\t#lib\n"
-			   << "\twin32:CONFIG(release, debug|release): LIBS += \"-L$$PWD/lib\" -l" << libName << "\n"
-			   << "\twin32:CONFIG(debug, debug|release): LIBS += \"-L$$PWD/lib\" -l" << libName << "d\n"
-			   << "\telse:unix: LIBS += \"-L$$PWD/lib\" -l" << libName << "\n\n"
-
-			   << "\twin32-g++:CONFIG(release, debug|release): QPMX_LIB_DEPS += $$PWD/lib/lib" << libName << ".a\n"
-			   << "\telse:win32-g++:CONFIG(debug, debug|release): QPMX_LIB_DEPS += $$PWD/lib/lib" << libName << "d.a\n"
-			   << "\telse:win32:!win32-g++:CONFIG(release, debug|release): QPMX_LIB_DEPS += $$PWD/lib/" << libName << ".lib\n"
-			   << "\telse:win32:!win32-g++:CONFIG(debug, debug|release): QPMX_LIB_DEPS += $$PWD/lib/" << libName << "d.lib\n"
-			   << "\telse:unix: QPMX_LIB_DEPS += $$PWD/lib/lib" << libName << ".a\n\n";
-		//add startup hook (if needed)
-		auto hooks = readMultiVar(_compileDir->filePath(QStringLiteral(".qpmx_startup_hooks")));
+	QStringList hooks;
+	QStringList resourceNames;
+	QStringList deferredHooks;
+	QStringList deferredResources;
+	if(build.hasBinary) {
+		//prepended after the dependencies were included, so the link line ends up in dependency order
+		stream << "\n\t#lib\n";
+		writeLibLines(stream, QStringLiteral("$$PWD"), libName, true);
+		stream << "\n";
+		//add startup hook (if needed) - each line is the hook id, followed by the function name
+		for(const auto &line : readMultiVar(build.compileDir->filePath(QStringLiteral(".qpmx_startup_hooks")))) {
+			auto hookId = line.section(QLatin1Char(' '), 0, 0);
+			if(build.format.deferredHooks.contains(line.section(QLatin1Char(' '), 1)))
+				deferredHooks.append(hookId);
+			else
+				hooks.append(hookId);
+		}
 		if(!hooks.isEmpty())
 			stream << "\tQPMX_STARTUP_HOOKS += \"" << hooks.join(QStringLiteral("\" \"")) << "\"\n";
+		if(!deferredHooks.isEmpty())
+			stream << "\tQPMX_DEFERRED_HOOKS += \"" << deferredHooks.join(QStringLiteral("\" \"")) << "\"\n";
 
-		auto resources = readVar(_compileDir->filePath(QStringLiteral(".qpmx_resources")));
-		if(!resources.isEmpty()) {
-			stream << "\tQPMX_RESOURCE_FILES +=";
-			for(const auto &res : resources)
-				stream << " \"" << QFileInfo(res).completeBaseName() << "\"";
-			stream << "\n";
+		for(const auto &res : readVar(build.compileDir->filePath(QStringLiteral(".qpmx_resources")))) {
+			auto resName = QFileInfo(res).completeBaseName();
+			if(build.format.deferredResources.contains(resName))
+				deferredResources.append(resName);
+			else
+				resourceNames.append(resName);
 		}
+		if(!resourceNames.isEmpty())
+			stream << "\tQPMX_RESOURCE_FILES += \"" << resourceNames.join(QStringLiteral("\" \"")) << "\"\n";
+		if(!deferredResources.isEmpty())
+			stream << "\tQPMX_DEFERRED_RESOURCES += \"" << deferredResources.join(QStringLiteral("\" \"")) << "\"\n";
 	}
-	if(!_format.prcFile.isEmpty()) {
+
+	//external resources are passed as rcc file paths, which the hook registers at runtime
+	QStringList rccFiles;
+	QStringList deferredRccFiles;
+	for(const auto &res : readVar(build.compileDir->filePath(QStringLiteral(".qpmx_external_resources")))) {
+		auto resName = QFileInfo(res).completeBaseName();
+		auto rccFile = QStringLiteral("resources/%1%2.rcc").arg(rccPrefix(build.current), resName);
+		if(build.format.deferredResources.contains(resName))
+			deferredRccFiles.append(rccFile);
+		else
+			rccFiles.append(rccFile);
+	}
+	if(!rccFiles.isEmpty())
+		stream << "\tQPMX_RESOURCE_FILES += \"$$PWD/" << rccFiles.join(QStringLiteral("\" \"$$PWD/")) << "\"\n";
+	if(!deferredRccFiles.isEmpty())
+		stream << "\tQPMX_DEFERRED_RESOURCES += \"$$PWD/" << deferredRccFiles.join(QStringLiteral("\" \"$$PWD/")) << "\"\n";
+	for(const auto &rccFile : qAsConst(rccFiles))
+		resourceNames.append(bDir.absoluteFilePath(rccFile));
+	for(const auto &rccFile : qAsConst(deferredRccFiles))
+		deferredResources.append(bDir.absoluteFilePath(rccFile));
+
+	if(!build.format.prcFile.isEmpty()) {
 		stream << "\n\t#prc include\n"
 			   << "\tQPMX_INSTALL_DIR=$$PWD\n"
-			   << "\tinclude(" << bDir.relativeFilePath(srcDir(_current).absoluteFilePath(_format.prcFile)) << ")\n"
+			   << "\tinclude(" << bDir.relativeFilePath(srcDir(build.current).absoluteFilePath(build.format.prcFile)) << ")\n"
 			   << "\tQPMX_INSTALL_DIR=\n";
 	}
 	stream << "}\n";
 	stream.flush();
-	metaFile.close();
+	writeStaged(build, QStringLiteral("include.pri"), priData, true);
+
+	//the same information in a form generate can use without evaluating include.pri
+	QJsonObject meta;
+	meta[QStringLiteral("package")] = build.current.package;
+	meta[QStringLiteral("lib")] = build.hasBinary ? libName : QString{};
+	meta[QStringLiteral("orderedLibs")] = true;
+	meta[QStringLiteral("hooks")] = QJsonArray::fromStringList(hooks);
+	meta[QStringLiteral("resources")] = QJsonArray::fromStringList(resourceNames);
+	meta[QStringLiteral("deferredHooks")] = QJsonArray::fromStringList(deferredHooks);
+	meta[QStringLiteral("deferredResources")] = QJsonArray::fromStringList(deferredResources);
+	meta[QStringLiteral("prcFile")] = build.format.prcFile.isEmpty() ?
+										  QString{} :
+										  srcDir(build.current).absoluteFilePath(build.format.prcFile);
+	writeStaged(build, QStringLiteral("meta.json"), QJsonDocument{meta}.toJson(QJsonDocument::Compact), false);
+}
+
+void CompileCommand::writeStaged(const Build &build, const QString &fileName, const QByteArray &data, bool text)
+{
+	auto stagedPath = QDir{build.stageDir->path()}.absoluteFilePath(fileName);
+	writeIfChanged(stagedPath, data, text);
+
+	//an identical file of the previous build keeps its timestamp, so projects including it do not rerun qmake
+	QFile oldFile{buildDir(build.kit.id, build.current).absoluteFilePath(fileName)};
+	if(!oldFile.open(QIODevice::ReadOnly | (text ? QIODevice::Text : QIODevice::NotOpen)) ||
+	   oldFile.readAll() != data)
+		return;
+	QFile stagedFile{stagedPath};
+	if(!stagedFile.open(QIODevice::ReadWrite) ||
+	   !stagedFile.setFileTime(oldFile.fileTime(QFileDevice::FileModificationTime), QFileDevice::FileModificationTime))
+		xDebug() << tr("Failed to keep the timestamp of %1").arg(fileName);
+}
+
+void CompileCommand::writeLibLines(QTextStream &stream, const QString &baseDir, const QString &libName, bool prepend, const QString &indent)
+{
+	//prepending puts the libraries of a package in front of the ones it depends on
+	auto assign = prepend ? QStringLiteral("LIBS =") : QStringLiteral("LIBS +=");
+	auto tail = prepend ? QStringLiteral(" $$LIBS") : QString{};
+	stream << indent << "win32:CONFIG(release, debug|release): " << assign << " \"-L" << baseDir << "/lib\" -l" << libName << tail << "\n"
+		   << indent << "win32:CONFIG(debug, debug|release): " << assign << " \"-L" << baseDir << "/lib\" -l" << libName << "d" << tail << "\n"
+		   << indent << "else:unix: " << assign << " \"-L" << baseDir << "/lib\" -l" << libName << tail << "\n\n"
+
+		   << indent << "win32-g++:CONFIG(release, debug|release): QPMX_LIB_DEPS += " << baseDir << "/lib/lib" << libName << ".a\n"
+		   << indent << "else:win32-g++:CONFIG(debug, debug|release): QPMX_LIB_DEPS += " << baseDir << "/lib/lib" << libName << "d.a\n"
+		   << indent << "else:win32:!win32-g++:CONFIG(release, debug|release): QPMX_LIB_DEPS += " << baseDir << "/lib/" << libName << ".lib\n"
+		   << indent << "else:win32:!win32-g++:CONFIG(debug, debug|release): QPMX_LIB_DEPS += " << baseDir << "/lib/" << libName << "d.lib\n"
+		   << indent << "else:unix: QPMX_LIB_DEPS += " << baseDir << "/lib/lib" << libName << ".a\n";
+}
+
+void CompileCommand::publish(Build &build)
+{
+	auto bDir = buildDir(build.kit.id, build.current);
+	buildDir(build.kit.id, build.current.provider, build.current.package, {}, true); //create parent dirs
+	auto sDir = stageDir(build.kit.id);
+	writeArtifactKey(build.stageDir->path());
+
+	//swap the previous build with the staged one, if the platform can do so atomically
+	if(bDir.exists() && exchangeDirs(build.stageDir->path(), bDir.absolutePath())) {
+		xDebug() << tr("Published build to cache directory");
+		if(!QDir{build.stageDir->path()}.removeRecursively())
+			xWarning() << tr("Failed to remove previous build of %1 with \"%2\"").arg(build.current.toString(), build.kit.path);
+		build.stageDir->setAutoRemove(false);
+		return;
+	}
+
+	//otherwise move the previous build out of the way, then move the staged one into place
+	QString oldPath;
+	if(bDir.exists()) {
+		oldPath = sDir.absoluteFilePath(QStringLiteral("old.") + BuildId{QUuid::createUuid()});
+		if(!sDir.rename(bDir.absolutePath(), oldPath)) {
+			throw tr("Failed to replace previous build of %1 with \"%2\"")
+					.arg(build.current.toString(), build.kit.path);
+		}
+	}
+
+	if(!sDir.rename(build.stageDir->path(), bDir.absolutePath())) {
+		if(!oldPath.isEmpty())
+			sDir.rename(oldPath, bDir.absolutePath());
+		throw tr("Failed to publish build of %1 with \"%2\" to the cache directory")
+				.arg(build.current.toString(), build.kit.path);
+	}
+	build.stageDir->setAutoRemove(false);
+	xDebug() << tr("Published build to cache directory");
+
+	if(!oldPath.isEmpty() && !QDir{oldPath}.removeRecursively())
+		xWarning() << tr("Failed to remove previous build of %1 with \"%2\"").arg(build.current.toString(), build.kit.path);
+}
+
+QDir CompileCommand::stageDir(const BuildId &kitId) const
+{
+	//lives in the kit directory, so publishing is a rename on the same file system
+	auto dir = buildDir(kitId);
+	auto name = QStringLiteral(".qpmx-staging");
+	if(!dir.mkpath(name) || !dir.cd(name))
+		throw tr("Failed to create staging directory");
+	return dir;
 }
 
 void CompileCommand::depCollect()
 {
-	TopSort<QpmxDevDependency> sortHelper(_pkgList, [](const QpmxDevDependency &d1, const QpmxDevDependency &d2) {
-		return d1 == d2 && d1.version == d2.version;
+	TopSort<QpmxDevDependency, PackageInfo> sortHelper(_pkgList, [](const QpmxDevDependency &dep) {
+		return dep.pkg();
 	});
 
-	QQueue<QpmxDevDependency> queue;
-	for(const auto &pkg : qAsConst(_pkgList))
-		queue.enqueue(pkg);
+	QQueue<int> queue;
+	for(auto i = 0; i < sortHelper.size(); i++)
+		queue.enqueue(i);
 
 	while(!queue.isEmpty()) {
-		auto pkg = queue.dequeue();
-		auto _pl = pkgLock(pkg);
+		auto pkgIndex = queue.dequeue();
+		auto pkg = sortHelper.at(pkgIndex);
+		auto _pl = pkgReadLock(pkg);
 		auto format = QpmxFormat::readFile(srcDir(pkg), true);
 		for(auto dep : qAsConst(format.dependencies)) {
 			// replace aliases
 			replaceAlias(dep, _aliases);
 			// insert as dep if needed
-			if(!sortHelper.contains(dep)) {
-				sortHelper.addData(dep);
-				queue.enqueue(dep);
+			auto depIndex = sortHelper.indexOf(dep);
+			if(depIndex == -1) {
+				depIndex = sortHelper.addData(dep);
+				queue.enqueue(depIndex);
 			}
-			sortHelper.addDependency(pkg, dep);
+			sortHelper.addDependency(pkgIndex, depIndex);
 		}
 	}
 
 	_pkgList = sortHelper.sort();
-	if(_pkgList.isEmpty())
-		throw tr("Cyclic dependencies detected! Unable to compile packages");
+	_pkgLevels = sortHelper.levels();
+	if(_pkgList.isEmpty()) {
+		QStringList cyclePath;
+		for(const auto &dep : sortHelper.cycle())
+			cyclePath.append(dep.toString());
+		throw tr("Cyclic dependencies detected: %1! Unable to compile packages")
+				.arg(cyclePath.join(QStringLiteral(" -> ")));
+	}
 	if(_explicitPkg.isEmpty())
 		_explicitPkg = _pkgList;
 }
 
-QString CompileCommand::findMake()
+QString CompileCommand::findMake(const Build &build)
 {
 	QString make;
 
-	if(make.isEmpty() && _kit.xspec.contains(QStringLiteral("msvc")))
+	if(make.isEmpty() && build.kit.xspec.contains(QStringLiteral("msvc")))
 		make = QStandardPaths::findExecutable(QStringLiteral("nmake"));
-	if(make.isEmpty() && _kit.xspec.contains(QStringLiteral("win32-g++")))
+	if(make.isEmpty() && build.kit.xspec.contains(QStringLiteral("win32-g++")))
 		make = QStandardPaths::findExecutable(QStringLiteral("mingw32-make"));
 
 	if(make.isEmpty())
@@ -428,34 +688,51 @@ QStringList CompileCommand::readVar(const QString &fileName)
 	return resList;
 }
 
-void CompileCommand::initProcess(const QString &program, const QString &logBase)
+void CompileCommand::initProcess(Build &build, const QString &program, const QString &logBase)
 {
-	if(_process)
-		_process->deleteLater();
-	_process = new QProcess(this);
-	_process->setProgram(program);
-	_process->setWorkingDirectory(_compileDir->path());
-	_process->setStandardOutputFile(_compileDir->filePath(QStringLiteral("%1.stdout.log").arg(logBase)));
+	build.process.reset(new QProcess{});
+	_processes.insert(build.process.data());
+	connect(build.process.data(), &QProcess::destroyed,
+			this, [this](QObject *process) {
+		_processes.remove(static_cast<QProcess*>(process));
+	});
+	build.process->setProgram(program);
+	build.process->setWorkingDirectory(build.compileDir->path());
+	build.process->setStandardOutputFile(build.compileDir->filePath(QStringLiteral("%1.stdout.log").arg(logBase)));
 	if(_fwdStderr)
-		_process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+		build.process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
 	else
-		_process->setStandardErrorFile(_compileDir->filePath(QStringLiteral("%1.stderr.log").arg(logBase)));
+		build.process->setStandardErrorFile(build.compileDir->filePath(QStringLiteral("%1.stderr.log").arg(logBase)));
 
 #ifndef QPMX_NO_MAKEBUG
-	_process->setProcessEnvironment(_procEnv);
+	build.process->setProcessEnvironment(_procEnv);
 #endif
 }
 
-void CompileCommand::raiseError(const QString &logBase)
+void CompileCommand::raiseError(const Build &build, const QString &logBase)
 {
-	if(_process->exitStatus() == QProcess::CrashExit) {
+	if(build.process->exitStatus() == QProcess::CrashExit) {
 		throw tr("Failed to run %1 step for %2 compilation. Error: %3")
-				.arg(logBase, _current.toString(), _process->errorString());
+				.arg(logBase, build.current.toString(), build.process->errorString());
 	} else {
 		throw tr("Failed to run %1 step for %2 compilation with exit code %3. Check the error logs at \"%4\"")
-				.arg(logBase, _current.toString())
-				.arg(_process->exitCode())
-				.arg(_compileDir->path());
+				.arg(logBase, build.current.toString())
+				.arg(build.process->exitCode())
+				.arg(build.compileDir->path());
+	}
+}
+
+void CompileCommand::terminateProcesses()
+{
+	const auto processes = _processes;
+	for(auto process : processes) {
+		if(process->state() == QProcess::NotRunning)
+			continue;
+		process->terminate();
+		if(!process->waitForFinished(2500)) {
+			process->kill();
+			process->waitForFinished(100);
+		}
 	}
 }
 
@@ -484,53 +761,77 @@ void CompileCommand::setupEnv()
 
 void CompileCommand::initKits(const QStringList &qmakes)
 {
-	//read exising qmakes
-	auto _kl = kitLock();
-	auto allKits = QtKitInfo::readFromSettings(buildDir());
+	//read exising qmakes - probing them is done without holding the kit registry
+	QList<QtKitInfo> knownKits;
+	{
+		auto _kl = kitReadLock();
+		knownKits = QtKitInfo::readFromSettings(buildDir());
+	}
 
 	//collect the kits to use, and ALWAYS update them!
+	QStringList paths;
+	QSet<QString> optional;
 	if(qmakes.isEmpty()) {
 		// update all known kits
-		QStringList pathsCache;
-		pathsCache.reserve(allKits.size());
-		for(auto i = 0; i < allKits.size(); i++) {
-			auto nKit = updateKit(allKits[i], false);
-			if(nKit) {
-				allKits[i] = nKit;
-				pathsCache.append(nKit.path);
-			} else
-				allKits.removeAt(i--);
+		for(const auto &kit : qAsConst(knownKits)) {
+			paths.append(kit.path);
+			optional.insert(kit.path);
 		}
 
 		//add system qmake, if valid and not already added
 		auto qmakePath = QStandardPaths::findExecutable(QStringLiteral("qmake"));
-		if(!qmakePath.isEmpty() && !pathsCache.contains(qmakePath)) {
-			auto nKit = createKit(qmakePath);
-			allKits.append(nKit);
-			xDebug() << tr("Added qmake from path: \"%1\"").arg(nKit.path);
+		if(!qmakePath.isEmpty() && !paths.contains(qmakePath))
+			paths.append(qmakePath);
+	} else
+		paths = qmakes;
+
+	QHash<QString, QtKitInfo> probedKits;
+	for(const auto &path : qAsConst(paths)) {
+		try {
+			probedKits.insert(path, createKit(path));
+		} catch (QString &s) {
+			if(!optional.contains(path))
+				throw;
+			xWarning() << tr("Invalid qmake \"%1\" removed from qmake list. Error: %2")
+						  .arg(path, s);
+			probedKits.insert(path, {});
 		}
-		_qtKits = allKits;
-	} else {
-		for(const auto &qmake : qmakes) {
-			//try to find a matching existing qmake config
-			auto found = false;
-			for(auto &allKit : allKits) {
-				if(allKit.path == qmake) {
-					found = true;
-					allKit = updateKit(allKit, true);
-					_qtKits.append(allKit);
-					break;
-				}
+	}
+
+	//merge with the current registry, as other instances might have changed it in the meantime
+	auto _kl = kitLock();
+	auto allKits = QtKitInfo::readFromSettings(buildDir());
+	for(const auto &path : qAsConst(paths)) {
+		auto nKit = probedKits.value(path);
+		auto kIndex = -1;
+		for(auto i = 0; i < allKits.size(); i++) {
+			if(allKits[i].path == path) {
+				kIndex = i;
+				break;
 			}
-			if(found)
-				continue;
+		}
+
+		if(!nKit) {
+			if(kIndex != -1)
+				allKits.removeAt(kIndex);
+			continue;
+		}
 
-			//not found -> create one
-			auto nKit = createKit(qmake);
+		if(kIndex == -1) {
 			allKits.append(nKit);
-			_qtKits.append(nKit);
-			xDebug() << tr("Added qmake from commandline: \"%1\"").arg(nKit.path);
+			xDebug() << tr("Added qmake: \"%1\"").arg(nKit.path);
+		} else if(allKits[kIndex] == nKit) {
+			nKit = allKits[kIndex];
+			xDebug() << tr("Validated existing qmake configuration for \"%1\"").arg(nKit.path);
+		} else {
+			xInfo() << tr("Updating existing qmake configuration for \"%1\"...").arg(nKit.path);
+			auto oDir = buildDir(allKits[kIndex].id);
+			if(!oDir.removeRecursively())
+				throw tr("Failed to remove build cache directory for \"%1\"").arg(nKit.path);
+			allKits[kIndex] = nKit;
+			xDebug() << tr("Updated existing qmake configuration for \"%1\"").arg(nKit.path);
 		}
+		_qtKits.append(nKit);
 	}
 
 	if(_qtKits.isEmpty())
@@ -602,32 +903,6 @@ QtKitInfo CompileCommand::createKit(const QString &qmakePath)
 	return kit;
 }
 
-QtKitInfo CompileCommand::updateKit(QtKitInfo oldKit, bool mustWork)
-{
-	try {
-		auto newKit = createKit(oldKit.path);
-		if(newKit == oldKit) {
-			xDebug() << tr("Validated existing qmake configuration for \"%1\"").arg(oldKit.path);
-			return oldKit;
-		} else {
-			xInfo() << tr("Updating existing qmake configuration for \"%1\"...").arg(oldKit.path);
-			auto oDir = buildDir(oldKit.id);
-			if(!oDir.removeRecursively())
-				throw tr("Failed to remove build cache directory for \"%1\"").arg(oldKit.path);
-			xDebug() << tr("Updated existing qmake configuration for \"%1\"").arg(oldKit.path);
-			return newKit;
-		}
-	} catch (QString &s) {
-		if(mustWork)
-			throw;
-		xWarning() << tr("Invalid qmake \"%1\" removed from qmake list. Error: %2")
-					  .arg(oldKit.path, s);
-		return {};
-	}
-}
-
-
-
 QtKitInfo::QtKitInfo(QString path) :
 	id{QUuid::createUuid()},
 	path{std::move(path)}
@@ -635,45 +910,12 @@ QtKitInfo::QtKitInfo(QString path) :
 
 QUuid QtKitInfo::findKitId(const QDir &buildDir, const QString &qmake)
 {
-	QUuid id;
-	QSettings settings{buildDir.absoluteFilePath(QStringLiteral("qt-kits.ini")), QSettings::IniFormat};
-
-	auto kitCnt = settings.beginReadArray(QStringLiteral("qt-kits"));
-	for(auto i = 0; i < kitCnt; i++) {
-		settings.setArrayIndex(i);
-		auto path = settings.value(QStringLiteral("path")).toString();
-		if(path == qmake) {
-			id = settings.value(QStringLiteral("id")).toUuid();
-			break;
-		}
-	}
-	settings.endArray();
-
-	return id;
+	return loadKitRegistry(buildDir).ids.value(qmake);
 }
 
 QList<QtKitInfo> QtKitInfo::readFromSettings(const QDir &buildDir)
 {
-	QSettings settings{buildDir.absoluteFilePath(QStringLiteral("qt-kits.ini")), QSettings::IniFormat};
-
-	QList<QtKitInfo> allKits;
-	auto kitCnt = settings.beginReadArray(QStringLiteral("qt-kits"));
-	for(auto i = 0; i < kitCnt; i++) {
-		settings.setArrayIndex(i);
-		QtKitInfo info;
-		info.id = settings.value(QStringLiteral("id"), info.id).toUuid();
-		info.path = settings.value(QStringLiteral("path"), info.path).toString();
-		info.qmakeVer = settings.value(QStringLiteral("qmakeVer"), QVariant::fromValue(info.qmakeVer)).value<QVersionNumber>();
-		info.qtVer = settings.value(QStringLiteral("qtVer"), QVariant::fromValue(info.qtVer)).value<QVersionNumber>();
-		info.spec = settings.value(QStringLiteral("spec"), info.spec).toString();
-		info.xspec = settings.value(QStringLiteral("xspec"), info.xspec).toString();
-		info.hostPrefix = settings.value(QStringLiteral("hostPrefix"), info.hostPrefix).toString();
-		info.installPrefix = settings.value(QStringLiteral("installPrefix"), info.installPrefix).toString();
-		info.sysRoot = settings.value(QStringLiteral("sysRoot"), info.sysRoot).toString();
-		allKits.append(info);
-	}
-	settings.endArray();
-	return allKits;
+	return loadKitRegistry(buildDir).kits;
 }
 
 void QtKitInfo::writeToSettings(const QDir &buildDir, const QList<QtKitInfo> &kitInfos)
@@ -698,6 +940,10 @@ void QtKitInfo::writeToSettings(const QDir &buildDir, const QList<QtKitInfo> &ki
 		settings.setValue(QStringLiteral("sysRoot"), info.sysRoot);
 	}
 	settings.endArray();
+	settings.sync();
+
+	QMutexLocker _{&kitRegistryLock};
+	kitRegistries.remove(buildDir.absoluteFilePath(QStringLiteral("qt-kits.ini")));
 }
 
 QtKitInfo::operator bool() const
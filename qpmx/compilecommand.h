@@ -6,6 +6,8 @@
 #include <QUuid>
 #include <QTemporaryDir>
 #include <QProcess>
+#include <QSet>
+#include <QTextStream>
 
 class QtKitInfo
 {
@@ -67,6 +69,10 @@ public:
 	QString commandDescription() const override;
 	QSharedPointer<QCliNode> createCliNode() const override;
 
+	static void writeLibLines(QTextStream &stream, const QString &baseDir, const QString &libName, bool prepend = false, const QString &indent = QStringLiteral("\t"));
+
+	void compileProject(const QString &qmake, bool recompile, bool fwdStderr, bool clean);
+
 protected slots:
 	void initialize(QCliParser &parser) override;
 	void finalize() override;
@@ -78,39 +84,51 @@ private:
 
 	QList<QpmxDevDependency> _pkgList;
 	QList<QpmxDevDependency> _explicitPkg;
-	QList<QpmxDevAlias> _aliases;
+	AliasMap _aliases;
 	QList<QtKitInfo> _qtKits;
 #ifndef QPMX_NO_MAKEBUG
 	QProcessEnvironment _procEnv;
 #endif
 
-	// temporary vars for compile steps
-	QpmxDevDependency _current;
-	QtKitInfo _kit;
-	QScopedPointer<BuildDir> _compileDir;
-	QpmxFormat _format;
-	QProcess *_process = nullptr;
-	bool _hasBinary = true;
+	// temporary vars for the compile steps of one package and kit
+	struct Build {
+		QpmxDevDependency current;
+		QtKitInfo kit;
+		QScopedPointer<BuildDir> compileDir;
+		QScopedPointer<QTemporaryDir> stageDir;
+		QpmxFormat format;
+		QScopedPointer<QProcess, QScopedPointerDeleteLater> process;
+		bool hasBinary = true;
+	};
+
+	QList<QList<QpmxDevDependency>> _pkgLevels;
+	QSet<QProcess*> _processes;
 
+	bool loadProject();
+	void compileAll(const QStringList &qmakes);
 	void compilePackages();
-	void qmake();
-	void make();
-	void install();
-	void priGen();
+	void compilePackage(const QpmxDevDependency &current);
+	void qmake(Build &build);
+	void make(Build &build);
+	void install(Build &build);
+	void priGen(Build &build);
+	void writeStaged(const Build &build, const QString &fileName, const QByteArray &data, bool text);
+	void publish(Build &build);
+	QDir stageDir(const BuildId &kitId) const;
 
 	void depCollect();
-	QString findMake();
+	QString findMake(const Build &build);
 	QStringList readMultiVar(const QString &dirName, bool recursive = false);
 	QStringList readVar(const QString &fileName);
-	void initProcess(const QString &program, const QString &logBase);
-	Q_NORETURN void raiseError(const QString &logBase);
+	void initProcess(Build &build, const QString &program, const QString &logBase);
+	Q_NORETURN void raiseError(const Build &build, const QString &logBase);
+	void terminateProcesses();
 #ifndef QPMX_NO_MAKEBUG
 	void setupEnv();
 #endif
 
 	void initKits(const QStringList &qmakes);
 	QtKitInfo createKit(const QString &qmakePath);
-	QtKitInfo updateKit(QtKitInfo oldKit, bool mustWork);
 };
 
 #endif // COMPILECOMMAND_H
@@ -50,7 +50,7 @@ void CreateCommand::initialize(QCliParser &parser)
 		}
 
 		xDebug() << tr("Finish qpmx.json creation");
-		qApp->quit();
+		quit();
 	} catch (QString &s) {
 		xCritical() << s;
 	}
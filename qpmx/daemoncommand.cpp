@@ -0,0 +1,486 @@
+#include "daemoncommand.h"
+#include "messagehandler.h"
+#include "bridge.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QMutex>
+#include <QProcessEnvironment>
+#include <QThread>
+#include <QTimer>
+#include <QWaitCondition>
+#include <iostream>
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <qtcoroutine.h>
+using namespace qpmx;
+
+static const quint32 RequestMagic = 0x51504d44;
+static const int ConnectTimeout = 100;
+static const int AcceptTimeout = 2000;
+static const int KeepAliveInterval = 5000;
+#ifdef Q_OS_UNIX
+static const int IdleTimeout = 6 * KeepAliveInterval;
+#else
+//keep alives are sent by the event loop, which a blocking command stalls, so this one is generous
+static const int IdleTimeout = 5 * 60 * 1000;
+#endif
+
+// sends all frames of one request. On unix, they are written directly to the socket descriptor,
+// so a separate thread can keep sending keep alives while a command blocks the event loop
+class DaemonCommand::FrameSender : public QThread
+{
+public:
+	explicit FrameSender(QLocalSocket *socket);
+	~FrameSender() override;
+
+	void send(Frame frame, qint32 value, const QString &message = {});
+
+protected:
+	void run() override;
+
+private:
+	QPointer<QLocalSocket> _socket;
+#ifdef Q_OS_UNIX
+	QMutex _mutex;
+	QWaitCondition _stopCondition;
+	bool _stopped = false;
+	int _fd = -1;
+	bool _viaSocket = false;
+
+	void write(const QByteArray &data);
+#else
+	QTimer _keepAlive;
+#endif
+};
+
+DaemonCommand::CommandFactory DaemonCommand::_factory = nullptr;
+
+DaemonCommand::DaemonCommand(QObject *parent) :
+	Command{parent}
+{}
+
+QString DaemonCommand::commandName() const
+{
+	return QStringLiteral("daemon");
+}
+
+QString DaemonCommand::commandDescription() const
+{
+	return tr("Start a background qpmx server that keeps plugins, kits and parsed qpmx files loaded. "
+			  "While it is running, the init, generate, hook and translate commands are executed by the "
+			  "daemon instead of a new qpmx process.");
+}
+
+QSharedPointer<QCliNode> DaemonCommand::createCliNode() const
+{
+	auto daemonNode = QSharedPointer<QCliLeaf>::create();
+	daemonNode->addOption({
+							  QStringLiteral("stop"),
+							  tr("Stop the daemon that is running for the current cache directory."),
+						  });
+	return daemonNode;
+}
+
+void DaemonCommand::setCommandFactory(CommandFactory factory)
+{
+	_factory = factory;
+}
+
+bool DaemonCommand::canForward(const QString &command)
+{
+	static const QStringList forwardable {
+		QStringLiteral("init"),
+		QStringLiteral("generate"),
+		QStringLiteral("hook"),
+		QStringLiteral("translate")
+	};
+	return forwardable.contains(command);
+}
+
+bool DaemonCommand::forward(const QStringList &arguments, const QString &workingDir, int &exitCode) const
+{
+	QLocalSocket socket;
+	socket.connectToServer(serverName());
+	if(!socket.waitForConnected(ConnectTimeout))
+		return false;
+
+	QDataStream stream{&socket};
+	stream.setVersion(QDataStream::Qt_5_6);
+	stream << RequestMagic
+		   << QCoreApplication::applicationVersion()
+		   << arguments
+		   << workingDir
+		   << QProcessEnvironment::systemEnvironment().toStringList();
+	socket.flush();
+
+	auto accepted = false;
+	forever {
+		stream.startTransaction();
+		quint8 frame;
+		qint32 value;
+		QString message;
+		stream >> frame >> value;
+		if(frame == MessageFrame)
+			stream >> message;
+		if(!stream.commitTransaction()) {
+			if(socket.state() == QLocalSocket::ConnectedState &&
+			   socket.waitForReadyRead(accepted ? IdleTimeout : AcceptTimeout))
+				continue;
+			//nothing was run yet if the daemon did not accept the request
+			if(!accepted) {
+				xDebug() << tr("The qpmx daemon did not accept the request in time. Running the command in-process");
+				socket.abort();
+				return false;
+			}
+			if(socket.state() == QLocalSocket::ConnectedState)
+				xCritical() << tr("The qpmx daemon stopped responding");
+			else
+				xCritical() << tr("Lost connection to the qpmx daemon");
+			exitCode = EXIT_FAILURE;
+			return true;
+		}
+
+		switch (frame) {
+		case AcceptFrame:
+			accepted = true;
+			break;
+		case KeepAliveFrame:
+			break;
+		case MessageFrame:
+			if(value == QtDebugMsg || value == QtInfoMsg)
+				std::cout << message.toStdString() << std::endl;
+			else
+				std::cerr << message.toStdString() << std::endl;
+			break;
+		case ExitFrame:
+			exitCode = value;
+			return true;
+		case RejectFrame:
+			xDebug() << tr("The qpmx daemon rejected or is busy with another request. Running the command in-process");
+			return false;
+		default:
+			Q_UNREACHABLE();
+			return false;
+		}
+	}
+}
+
+void DaemonCommand::initialize(QCliParser &parser)
+{
+	try {
+		if(parser.isSet(QStringLiteral("stop"))) {
+			auto exitCode = EXIT_SUCCESS;
+			if(forward({commandName(), QStringLiteral("--stop")}, QDir::currentPath(), exitCode))
+				xInfo() << tr("Stopped the qpmx daemon");
+			else
+				xWarning() << tr("No qpmx daemon is running for this cache directory");
+			quit();
+			return;
+		}
+
+		if(!_factory)
+			throw tr("No commands are available to the daemon");
+
+		//a stale socket of a crashed daemon blocks listening, a running daemon answers
+		auto name = serverName();
+		QLocalSocket probe;
+		probe.connectToServer(name);
+		if(probe.waitForConnected(ConnectTimeout))
+			throw tr("A qpmx daemon is already running for this cache directory");
+		QLocalServer::removeServer(name);
+
+		_server = new QLocalServer{this};
+		_server->setSocketOptions(QLocalServer::UserAccessOption);
+		if(!_server->listen(name))
+			throw tr("Failed to start the daemon with error: %1").arg(_server->errorString());
+		connect(_server, &QLocalServer::newConnection,
+				this, &DaemonCommand::newConnection);
+
+		_DaemonMode = true;
+		_parser = &parser;
+		xInfo() << tr("qpmx daemon listening on %{bld}%1%{end}").arg(_server->fullServerName());
+	} catch(QString &s) {
+		xCritical() << s;
+	}
+}
+
+QString DaemonCommand::serverName() const
+{
+	auto cacheHash = QCryptographicHash::hash(cacheDir().absolutePath().toUtf8(), QCryptographicHash::Sha1);
+	return QStringLiteral("qpmx-%1").arg(QString::fromLatin1(cacheHash.toHex().left(16)));
+}
+
+void DaemonCommand::newConnection()
+{
+	while(_server->hasPendingConnections()) {
+		auto socket = _server->nextPendingConnection();
+		connect(socket, &QLocalSocket::disconnected,
+				socket, &QLocalSocket::deleteLater);
+		connect(socket, &QLocalSocket::readyRead,
+				this, [this, socket](){
+			readRequest(socket);
+		});
+	}
+}
+
+void DaemonCommand::readRequest(QLocalSocket *socket)
+{
+	QDataStream stream{socket};
+	stream.setVersion(QDataStream::Qt_5_6);
+	stream.startTransaction();
+	quint32 magic;
+	QString version;
+	Request request;
+	stream >> magic
+		   >> version
+		   >> request.arguments
+		   >> request.workingDir
+		   >> request.environment;
+	if(!stream.commitTransaction())
+		return;
+
+	disconnect(socket, &QLocalSocket::readyRead,
+			   this, nullptr);
+	if(magic != RequestMagic || version != QCoreApplication::applicationVersion()) {
+		xWarning() << tr("Rejected request from an incompatible qpmx client");
+		sendFrame(socket, RejectFrame, 0);
+		socket->disconnectFromServer();
+		return;
+	}
+
+	//requests share the working directory, environment and logging, and thus cannot run side by side.
+	//instead of queueing, busy requests are handed back - the client then runs them in-process in parallel
+	if(_busy) {
+		if(request.arguments.contains(commandName()) &&
+		   request.arguments.contains(QStringLiteral("--stop"))) {
+			xDebug() << tr("Stopping qpmx daemon after the current request");
+			_stop = true;
+			sendFrame(socket, AcceptFrame, 0);
+			sendFrame(socket, ExitFrame, EXIT_SUCCESS);
+		} else {
+			xDebug() << tr("Busy with another request, handing it back to the client");
+			sendFrame(socket, RejectFrame, 0);
+		}
+		socket->disconnectFromServer();
+		return;
+	}
+
+	request.socket = socket;
+	processRequest(request);
+}
+
+void DaemonCommand::processRequest(const Request &request)
+{
+	_busy = true;
+	QtCoroutine::createAndRun([this, request](){
+		//the client may have given up waiting and run the command itself
+		if(request.socket && request.socket->state() == QLocalSocket::ConnectedState) {
+			{
+				FrameSender sender{request.socket};
+				sender.send(AcceptFrame, 0);
+				auto exitCode = serve(request, sender);
+				sender.send(ExitFrame, exitCode);
+			}
+			if(request.socket)
+				request.socket->disconnectFromServer();
+		}
+		_busy = false;
+		if(_stop)
+			qApp->quit();
+	});
+}
+
+int DaemonCommand::serve(const Request &request, FrameSender &sender)
+{
+	//statistics are per process, but reported per request
+	resetStats();
+	auto oldDir = QDir::currentPath();
+	auto oldEnv = QProcessEnvironment::systemEnvironment().toStringList();
+	auto oldBridge = priv::QpmxBridge::instance();
+	applyEnvironment(request.environment);
+
+	QObject scope;
+	auto commands = _factory(&scope);
+	QCliParser parser;
+	setupParser(parser, commands);
+
+	auto exitCode = EXIT_FAILURE;
+	MessageHandler::setSink([&sender](QtMsgType type, const QString &message) {
+		sender.send(MessageFrame, type, message);
+	});
+	try {
+		if(!QDir::setCurrent(request.workingDir))
+			throw tr("Failed to enter working directory \"%1\"").arg(request.workingDir);
+		if(!parser.parse(QStringList{QCoreApplication::applicationFilePath()} + request.arguments, true))
+			throw parser.errorText();
+		MessageHandler::setup(parser);
+		if(parser.isSet(QStringLiteral("dir")) &&
+		   !QDir::setCurrent(parser.value(QStringLiteral("dir"))))
+			throw tr("Failed to enter working directory \"%1\"").arg(parser.value(QStringLiteral("dir")));
+
+		Command *cmd = nullptr;
+		for(auto it = commands.constBegin(); it != commands.constEnd(); it++) {
+			if(parser.enterContext(it.key())) {
+				cmd = it.value();
+				break;
+			}
+		}
+
+		if(cmd && cmd->commandName() == commandName()) {
+			if(!parser.isSet(QStringLiteral("stop")))
+				throw tr("A qpmx daemon is already running for this cache directory");
+			xDebug() << tr("Stopping qpmx daemon");
+			_stop = true;
+			exitCode = EXIT_SUCCESS;
+		} else if(cmd && canForward(cmd->commandName())) {
+			priv::Bridge bridge{cmd};
+			priv::QpmxBridge::registerInstance(&bridge);
+			_Failed = false;
+			cmd->init(parser);
+			cmd->fin();
+			priv::QpmxBridge::registerInstance(oldBridge);
+			exitCode = failed() ? Command::exitCode() : EXIT_SUCCESS;
+		} else
+			throw tr("The requested command cannot be run by the qpmx daemon");
+		parser.leaveContext();
+	} catch(QString &s) {
+		xCritical() << s;
+		priv::QpmxBridge::registerInstance(oldBridge);
+	}
+
+	MessageHandler::setSink({});
+	MessageHandler::setup(*_parser);
+	QDir::setCurrent(oldDir);
+	applyEnvironment(oldEnv);
+	return exitCode;
+}
+
+QByteArray DaemonCommand::frameData(Frame frame, qint32 value, const QString &message)
+{
+	QByteArray data;
+	QDataStream stream{&data, QIODevice::WriteOnly};
+	stream.setVersion(QDataStream::Qt_5_6);
+	stream << static_cast<quint8>(frame) << value;
+	if(frame == MessageFrame)
+		stream << message;
+	return data;
+}
+
+void DaemonCommand::sendFrame(QLocalSocket *socket, Frame frame, qint32 value, const QString &message)
+{
+	socket->write(frameData(frame, value, message));
+}
+
+void DaemonCommand::applyEnvironment(const QStringList &environment)
+{
+	auto current = QProcessEnvironment::systemEnvironment();
+	QProcessEnvironment target;
+	for(const auto &entry : environment) {
+		auto split = entry.indexOf(QLatin1Char('='));
+		if(split > 0)
+			target.insert(entry.left(split), entry.mid(split + 1));
+	}
+
+	for(const auto &key : current.keys()) {
+		if(!target.contains(key))
+			qunsetenv(qUtf8Printable(key));
+	}
+	for(const auto &key : target.keys()) {
+		if(current.value(key) != target.value(key))
+			qputenv(qUtf8Printable(key), target.value(key).toLocal8Bit());
+	}
+}
+
+
+
+DaemonCommand::FrameSender::FrameSender(QLocalSocket *socket) :
+	_socket{socket}
+{
+#ifdef Q_OS_UNIX
+	//everything the socket buffered must be sent before writing past it
+	_socket->flush();
+	_socket->waitForBytesWritten(ConnectTimeout);
+	_fd = ::fcntl(static_cast<int>(_socket->socketDescriptor()), F_DUPFD_CLOEXEC, 0);
+	if(_fd != -1)
+		start();
+	else {
+		xDebug() << DaemonCommand::tr("Failed to duplicate the client socket, keep alives are not available");
+		_viaSocket = true;
+	}
+#else
+	_keepAlive.setInterval(KeepAliveInterval);
+	connect(&_keepAlive, &QTimer::timeout, [this](){
+		send(KeepAliveFrame, 0);
+	});
+	_keepAlive.start();
+#endif
+}
+
+DaemonCommand::FrameSender::~FrameSender()
+{
+#ifdef Q_OS_UNIX
+	{
+		QMutexLocker _{&_mutex};
+		_stopped = true;
+		_stopCondition.wakeAll();
+	}
+	wait();
+	if(_fd != -1)
+		::close(_fd);
+#endif
+}
+
+void DaemonCommand::FrameSender::send(Frame frame, qint32 value, const QString &message)
+{
+#ifdef Q_OS_UNIX
+	if(!_viaSocket) {
+		QMutexLocker _{&_mutex};
+		write(frameData(frame, value, message));
+		return;
+	}
+#endif
+	if(_socket)
+		sendFrame(_socket, frame, value, message);
+}
+
+void DaemonCommand::FrameSender::run()
+{
+#ifdef Q_OS_UNIX
+	QMutexLocker _{&_mutex};
+	while(!_stopped) {
+		if(!_stopCondition.wait(&_mutex, KeepAliveInterval))
+			write(frameData(KeepAliveFrame, 0));
+	}
+#endif
+}
+
+#ifdef Q_OS_UNIX
+void DaemonCommand::FrameSender::write(const QByteArray &data)
+{
+	auto flags = 0;
+#ifdef MSG_NOSIGNAL
+	flags = MSG_NOSIGNAL;
+#endif
+	auto written = 0;
+	while(_fd != -1 && written < data.size()) {
+		auto res = ::send(_fd, data.constData() + written, static_cast<size_t>(data.size() - written), flags);
+		if(res >= 0)
+			written += static_cast<int>(res);
+		else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+			pollfd pfd{_fd, POLLOUT, 0};
+			::poll(&pfd, 1, KeepAliveInterval);
+		} else if(errno != EINTR) {
+			//the client is gone, the command still runs to completion
+			::close(_fd);
+			_fd = -1;
+		}
+	}
+}
+#endif
+
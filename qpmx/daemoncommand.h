@@ -0,0 +1,66 @@
+#ifndef DAEMONCOMMAND_H
+#define DAEMONCOMMAND_H
+
+#include "command.h"
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPointer>
+
+class DaemonCommand : public Command
+{
+	Q_OBJECT
+
+public:
+	using CommandFactory = QHash<QString, Command*>(*)(QObject *parent);
+
+	explicit DaemonCommand(QObject *parent = nullptr);
+
+	QString commandName() const override;
+	QString commandDescription() const override;
+	QSharedPointer<QCliNode> createCliNode() const override;
+
+	static void setCommandFactory(CommandFactory factory);
+	static bool canForward(const QString &command);
+	bool forward(const QStringList &arguments, const QString &workingDir, int &exitCode) const;
+
+protected slots:
+	void initialize(QCliParser &parser) override;
+
+private:
+	enum Frame : quint8 {
+		MessageFrame,
+		ExitFrame,
+		RejectFrame,
+		AcceptFrame,
+		KeepAliveFrame
+	};
+
+	class FrameSender;
+
+	struct Request {
+		QPointer<QLocalSocket> socket;
+		QStringList arguments;
+		QString workingDir;
+		QStringList environment;
+	};
+
+	static CommandFactory _factory;
+
+	QCliParser *_parser = nullptr;
+	QLocalServer *_server = nullptr;
+	bool _busy = false;
+	bool _stop = false;
+
+	QString serverName() const;
+
+	void newConnection();
+	void readRequest(QLocalSocket *socket);
+	void processRequest(const Request &request);
+	int serve(const Request &request, FrameSender &sender);
+	static QByteArray frameData(Frame frame, qint32 value, const QString &message = {});
+	static void sendFrame(QLocalSocket *socket, Frame frame, qint32 value, const QString &message = {});
+	static void applyEnvironment(const QStringList &environment);
+};
+
+#endif // DAEMONCOMMAND_H
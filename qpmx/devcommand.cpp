@@ -107,7 +107,7 @@ void DevCommand::initialize(QCliParser &parser)
 						  .arg(devCache.absolutePath());
 		}
 
-		qApp->quit();
+		quit();
 	} catch (QString &s) {
 		xCritical() << s;
 	}
@@ -1,12 +1,18 @@
 #include "compilecommand.h"
 #include "generatecommand.h"
 
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+#include <QSaveFile>
 #include <QStandardPaths>
+
+#include <qtcoawaitables.h>
 using namespace qpmx;
 
 GenerateCommand::GenerateCommand(QObject *parent) :
 	Command(parent),
-	_genFile(nullptr),
 	_qmake()
 {}
 
@@ -36,6 +42,16 @@ QSharedPointer<QCliNode> GenerateCommand::createCliNode() const
 								{QStringLiteral("r"), QStringLiteral("recreate")},
 								tr("Always delete and recreate the file if it exists, not only when the configuration changed."),
 						   });
+	generateNode->addOption({
+								QStringLiteral("flat"),
+								tr("Resolve all dependencies ahead of time and write them into a single pri file, "
+								   "instead of including the include.pri of every package."),
+							});
+	generateNode->addOption({
+								QStringLiteral("prelink"),
+								tr("Prelink all package libraries into a single relocatable object that applications link "
+								   "against instead of the libraries. Implies --flat. Only supported for linux kits."),
+							});
 	return generateNode;
 }
 
@@ -45,47 +61,65 @@ void GenerateCommand::initialize(QCliParser &parser)
 		if(parser.positionalArguments().size() != 1)
 			throw tr("Invalid arguments! You must specify the target directory as a single parameter");
 
-		QDir tDir(parser.positionalArguments().value(0));
-		if(!tDir.mkpath(QStringLiteral(".")))
-			throw tr("Failed to create target directory");
-		_genFile = new QFile(tDir.absoluteFilePath(QStringLiteral("qpmx_generated.pri")), this);
-		auto cachePath = tDir.absoluteFilePath(QStringLiteral(".qpmx.cache"));
-
-		//qmake kit
-		_qmake = parser.value(QStringLiteral("qmake"));
-		if(!QFile::exists(_qmake))
-			throw tr("Choosen qmake executable \"%1\" does not exist").arg(_qmake);
-
-		auto mainFormat = QpmxUserFormat::readDefault(true);
-		if(_genFile->exists()) {
-			if(!parser.isSet(QStringLiteral("recreate"))) {
-				auto cacheFormat = QpmxCacheFormat::readCached(tDir);
-				if(!hasChanged(mainFormat, cacheFormat)) {
-					xDebug() << tr("Unchanged configuration. Skipping generation");
-					qApp->quit();
-					return;
-				}
-			}
+		generate(parser.positionalArguments().value(0),
+				 parser.value(QStringLiteral("qmake")),
+				 parser.isSet(QStringLiteral("recreate")),
+				 parser.isSet(QStringLiteral("flat")),
+				 parser.isSet(QStringLiteral("prelink")));
+		quit();
+	} catch (QString &s) {
+		xCritical() << s;
+	}
+}
 
-			if(!_genFile->remove())
-				throw tr("Failed to remove qpmx_generated.pri with error: %1").arg(_genFile->errorString());
-			if(QFile::exists(cachePath) && !QFile::remove(cachePath))
-				throw tr("Failed to remove qpmx cache file");
-		}
+void GenerateCommand::generate(const QString &outdir, const QString &qmake, bool recreate, bool flat, bool prelink)
+{
+	_flat = flat || prelink;
+	_prelink = prelink;
+	QDir tDir(outdir);
+	if(!tDir.mkpath(QStringLiteral(".")))
+		throw tr("Failed to create target directory");
+	_genPath = tDir.absoluteFilePath(QStringLiteral("qpmx_generated.pri"));
+	auto fingerprintPath = tDir.absoluteFilePath(QStringLiteral(".qpmx.fingerprint"));
 
-		//create the file
-		xInfo() << tr("Updating qpmx_generated.pri to apply changes");
-		if(mainFormat.hasDevOptions())
-			setDevMode(true);
-		createPriFile(mainFormat);
-		if(!QpmxCacheFormat::writeCached(tDir, cachedFormat(mainFormat)))
-			xWarning() << tr("Failed to cache qpmx.json file. This means generate will always recreate the qpmx_generated.pri");
+	//qmake kit
+	_qmake = qmake;
+	if(!QFile::exists(_qmake))
+		throw tr("Choosen qmake executable \"%1\" does not exist").arg(_qmake);
 
-		xDebug() << tr("Pri-File generation completed");
-		qApp->quit();
-	} catch (QString &s) {
-		xCritical() << s;
+	auto mainFormat = QpmxUserFormat::readDefault(true);
+	if(mainFormat.hasDevOptions())
+		setDevMode(true);
+	_kitId = kitId(mainFormat);
+	auto currentPrint = fingerprint(mainFormat);
+	if(QFile::exists(_genPath)) {
+		if(!recreate) {
+			QFile printFile{fingerprintPath};
+			if(printFile.open(QIODevice::ReadOnly) && printFile.readAll() == currentPrint) {
+				xDebug() << tr("Unchanged configuration. Skipping generation");
+				return;
+			}
+		}
+
+		//the pri file itself is only replaced if its content changes
+		if(QFile::exists(fingerprintPath) && !QFile::remove(fingerprintPath))
+			throw tr("Failed to remove qpmx fingerprint file");
 	}
+	//replaced by the fingerprint
+	QFile::remove(tDir.absoluteFilePath(QStringLiteral(".qpmx.cache")));
+
+	//create the file
+	if(createPriFile(mainFormat))
+		xInfo() << tr("Updated qpmx_generated.pri to apply changes");
+	else
+		xDebug() << tr("Generated qpmx_generated.pri is unchanged");
+	QSaveFile printFile{fingerprintPath};
+	if(!printFile.open(QIODevice::WriteOnly) ||
+	   printFile.write(currentPrint) == -1 ||
+	   !printFile.commit())
+		xWarning() << tr("Failed to save configuration fingerprint. This means generate will always recreate the qpmx_generated.pri");
+
+	xDebug() << tr("Pri-File generation completed");
 }
 
 Command::BuildId GenerateCommand::kitId(const QpmxUserFormat &format) const
@@ -96,69 +130,64 @@ Command::BuildId GenerateCommand::kitId(const QpmxUserFormat &format) const
 		return QtKitInfo::findKitId(buildDir(), _qmake);
 }
 
-QpmxCacheFormat GenerateCommand::cachedFormat(const QpmxUserFormat &format) const
+QByteArray GenerateCommand::fingerprint(const QpmxUserFormat &format) const
 {
-	return {format, kitId(format)};
-}
+	QCryptographicHash hash{QCryptographicHash::Sha256};
+	auto addData = [&](const QString &data) {
+		auto utf8 = data.toUtf8();
+		hash.addData(QByteArray::number(utf8.size()));
+		hash.addData(":", 1);
+		hash.addData(utf8);
+	};
 
-bool GenerateCommand::hasChanged(const QpmxUserFormat &currentUser, const QpmxCacheFormat &cache)
-{
-	auto current = cachedFormat(currentUser);
-
-	if(current.buildKit != cache.buildKit ||
-	   current.source != cache.source ||
-	   current.prcFile != cache.prcFile ||
-	   current.priIncludes != cache.priIncludes ||
-	   current.dependencies.size() != cache.dependencies.size())
-		return true;
-
-	auto cCache = cache.dependencies;
-	for(const auto &dep : qAsConst(current.dependencies)) {
-		auto cIdx = cCache.indexOf(dep);
-		if(cIdx == -1)
-			return true;
-		if(dep.version != cCache.takeAt(cIdx).version)
-			return true;
-	}
-	if(!cCache.isEmpty())
-		return true;
-
-	auto dCache = cache.devDependencies;
-	for(const auto &dep : qAsConst(current.devDependencies)) {
-		auto cIdx = dCache.indexOf(dep);
-		if(cIdx == -1)
-			return true;
-		auto dDep = dCache.takeAt(cIdx);
-		if(dep.version != dDep.version ||
-		   dep.path != dDep.path)
-			return true;
-	}
-	if(!dCache.isEmpty())
-		return true;
-
-	auto aCache = cache.devAliases;
-	for(const auto &alias : qAsConst(current.devAliases)) {
-		auto cIdx = aCache.indexOf(alias);
-		if(cIdx == -1)
-			return true;
-		auto cAlias = aCache.takeAt(cIdx);
-		if(cAlias.alias != alias.alias ||
-		   cAlias.alias.version != alias.alias.version)
-			return true;
-	}
-	if(!aCache.isEmpty())
-		return true;
-
-	return false;
+	addData(_kitId);
+	addData(format.source ? QStringLiteral("source") : QStringLiteral("binary"));
+	addData(_flat ? QStringLiteral("flat") : QStringLiteral("nested"));
+	addData(_prelink ? QStringLiteral("prelink") : QStringLiteral("archives"));
+	addData(format.prcFile);
+	addData(format.priIncludes.join(QLatin1Char('\n')));
+
+	//the order of dependencies and aliases does not change the result
+	QStringList entries;
+	entries.reserve(format.dependencies.size());
+	for(const auto &dep : format.dependencies)
+		entries.append(dep.toString());
+	entries.sort();
+	addData(entries.join(QLatin1Char('\n')));
+
+	entries.clear();
+	for(const auto &dep : format.devDependencies)
+		entries.append(dep.toString() + QLatin1Char('=') + dep.path);
+	entries.sort();
+	addData(entries.join(QLatin1Char('\n')));
+
+	entries.clear();
+	for(const auto &alias : format.devAliases)
+		entries.append(alias.original.toString() + QLatin1Char('=') + alias.alias.toString());
+	entries.sort();
+	addData(entries.join(QLatin1Char('\n')));
+
+	//artifacts of all included packages, so rebuilt packages count as a change as well
+	addData(projectArtifacts(format, _kitId));
+
+	return hash.result().toHex();
 }
 
-void GenerateCommand::createPriFile(const QpmxUserFormat &current)
+bool GenerateCommand::createPriFile(const QpmxUserFormat &current)
 {
-	if(!_genFile->open(QIODevice::WriteOnly | QIODevice::Text))
-		throw tr("Failed to open qpmx_generated.pri with error: %1").arg(_genFile->errorString());
+	//deps are checked first - only a fully ordered link line can skip the linker group
+	QString flatDeps;
+	auto linkGroup = !current.source;
+	if(_flat && !current.source) {
+		QTextStream flatStream(&flatDeps);
+		if(writeFlatDeps(flatStream, current) && current.priIncludes.isEmpty())
+			linkGroup = false;
+	} else if(!current.source && current.priIncludes.isEmpty())
+		linkGroup = !orderedIncludes(current);
 
 	//create & prepare
-	QTextStream stream(_genFile);
+	QByteArray priData;
+	QTextStream stream(&priData);
 	stream << "!qpmx_sub_pri {\n"
 		   << "\tQPMX_TMP_TS = $$TRANSLATIONS\n"
 		   << "\tTRANSLATIONS = \n"
@@ -167,8 +196,9 @@ void GenerateCommand::createPriFile(const QpmxUserFormat &current)
 		stream << "\tCONFIG += qpmx_src_build\n";
 	else {
 		stream << "\tQPMX_APP_LIBS = $$LIBS\n"
-			   << "\tLIBS =\n"
-			   << "\tgcc:!mac: LIBS += -Wl,--start-group\n";
+			   << "\tLIBS =\n";
+		if(linkGroup)
+			stream << "\tgcc:!mac: LIBS += -Wl,--start-group\n";
 	}
 	stream << "}\n\n";
 
@@ -200,9 +230,13 @@ void GenerateCommand::createPriFile(const QpmxUserFormat &current)
 	//add dependencies
 	stream << "\n#dependencies\n"
 		   << "QPMX_TS_DIRS = \n"; //clean for only use local deps
-	for(const auto &dep : current.allDeps()) {
-		auto dir = buildDir(kitId(current), dep.pkg());
-		stream << "include(" << dir.absoluteFilePath(QStringLiteral("include.pri")) << ")\n";
+	if(_flat && !current.source)
+		stream << flatDeps;
+	else {
+		for(const auto &dep : current.allDeps()) {
+			auto dir = buildDir(_kitId, dep.pkg());
+			stream << "include(" << dir.absoluteFilePath(QStringLiteral("include.pri")) << ")\n";
+		}
 	}
 
 	//top-level pri only
@@ -236,12 +270,243 @@ void GenerateCommand::createPriFile(const QpmxUserFormat &current)
 
 	//final
 	if(!current.source) {
-		stream << "\n\tgcc:!mac: LIBS += -Wl,--end-group\n"
-			   << "\tqpmx_as_private_lib: LIBS_PRIVATE += $$LIBS\n"
+		stream << "\n";
+		if(linkGroup)
+			stream << "\tgcc:!mac: LIBS += -Wl,--end-group\n";
+		stream << "\tqpmx_as_private_lib: LIBS_PRIVATE += $$LIBS\n"
 			   << "\telse: QPMX_APP_LIBS += $$LIBS\n"
 			   << "\tLIBS = $$QPMX_APP_LIBS\n";
 	}
 	stream << "}\n";
 	stream.flush();
-	_genFile->close();
+	return writeIfChanged(_genPath, priData);
+}
+
+TopSort<QpmxDevDependency, PackageInfo> GenerateCommand::depGraph(const QpmxUserFormat &current)
+{
+	//resolve the transitive closure, dependencies first - the order the include.pri files would have been evaluated in
+	auto aliases = aliasMap(current.devAliases);
+	QHash<PackageInfo, QpmxDevDependency> devDeps;
+	for(const auto &dep : current.devDependencies)
+		devDeps.insert(dep.pkg(), dep);
+	TopSort<QpmxDevDependency, PackageInfo> sortHelper(current.allDeps(), [](const QpmxDevDependency &dep) {
+		return dep.pkg();
+	});
+	for(auto i = 0; i < sortHelper.size(); i++) {
+		auto pkg = sortHelper.at(i);
+		QpmxFormat format;
+		{
+			auto _rl = pkgReadLock(pkg);
+			format = QpmxFormat::readFile(srcDir(pkg), true);
+		}
+		for(auto dep : qAsConst(format.dependencies)) {
+			replaceAlias(dep, aliases);
+			auto depIndex = sortHelper.addData(devDeps.value(dep.pkg(), dep));
+			sortHelper.addDependency(i, depIndex);
+		}
+	}
+	return sortHelper;
+}
+
+bool GenerateCommand::orderedIncludes(const QpmxUserFormat &current)
+{
+	//every include.pri prepends its library after including its dependencies - except for builds of older versions
+	auto sortHelper = depGraph(current);
+	for(auto i = 0; i < sortHelper.size(); i++) {
+		const auto &dep = sortHelper.at(i);
+		QFile metaFile{buildDir(_kitId, dep).absoluteFilePath(QStringLiteral("meta.json"))};
+		if(!metaFile.open(QIODevice::ReadOnly) ||
+		   !QJsonDocument::fromJson(metaFile.readAll()).object()[QStringLiteral("orderedLibs")].toBool()) {
+			xDebug() << tr("%1 was compiled by an older qpmx version. Linking all packages as a group").arg(dep.toString());
+			return false;
+		}
+	}
+	return true;
+}
+
+bool GenerateCommand::writeFlatDeps(QTextStream &stream, const QpmxUserFormat &current)
+{
+	auto sortHelper = depGraph(current);
+
+	//libraries are prepended in dependency order, so every package ends up in front of its dependencies.
+	//only packages that depend on each other in a cycle still need a linker group
+	QString depsData;
+	QTextStream depsStream(&depsData);
+	auto ordered = true;
+	_prelinkInputs.clear();
+	for(const auto &component : sortHelper.components()) {
+		auto cyclic = component.size() > 1;
+		if(cyclic) {
+			QStringList cyclePath;
+			for(const auto &dep : component)
+				cyclePath.append(dep.toString());
+			xWarning() << tr("Cyclic dependencies detected: %1! Linking them as a group")
+						  .arg(cyclePath.join(QStringLiteral(", ")));
+			depsStream << "gcc:!mac: LIBS = -Wl,--end-group $$LIBS\n";
+		}
+		for(const auto &dep : component) {
+			if(!writeFlatPackage(depsStream, current, dep))
+				ordered = false;
+		}
+		if(cyclic)
+			depsStream << "gcc:!mac: LIBS = -Wl,--start-group $$LIBS\n";
+	}
+	depsStream.flush();
+
+	//applications link the prelinked object instead of the package libraries
+	QString prelinkObj;
+	if(_prelink) {
+		if(!ordered || !current.priIncludes.isEmpty())
+			xWarning() << tr("Prelinking requires build metadata for all packages and no pri includes. Linking the libraries instead");
+		else if(!_prelinkInputs.isEmpty())
+			prelinkObj = prelink();
+	}
+	if(!prelinkObj.isEmpty()) {
+		stream << "!qpmx_sub_pri {\n"
+			   << "\t!equals(TEMPLATE, lib)|qpmx_no_libbuild: CONFIG += qpmx_prelinked\n"
+			   << "}\n";
+	}
+	stream << depsData;
+	if(!prelinkObj.isEmpty()) {
+		stream << "!qpmx_sub_pri:qpmx_prelinked {\n"
+			   << "\tLIBS = \"" << prelinkObj << "\" $$LIBS\n"
+			   << "\tPRE_TARGETDEPS += \"" << prelinkObj << "\"\n"
+			   << "}\n";
+	}
+	return ordered;
+}
+
+bool GenerateCommand::writeFlatPackage(QTextStream &stream, const QpmxUserFormat &current, const QpmxDevDependency &dep)
+{
+	auto dir = buildDir(_kitId, dep);
+	QFile metaFile{dir.absoluteFilePath(QStringLiteral("meta.json"))};
+	if(!metaFile.open(QIODevice::ReadOnly)) {
+		xDebug() << tr("No build metadata found for %1. Including its include.pri instead").arg(dep.toString());
+		stream << "include(" << dir.absoluteFilePath(QStringLiteral("include.pri")) << ")\n";
+		return false;
+	}
+	auto meta = QJsonDocument::fromJson(metaFile.readAll()).object();
+	metaFile.close();
+
+	//without pri includes, only a parent project can have added the package already
+	auto package = meta[QStringLiteral("package")].toString();
+	if(current.priIncludes.isEmpty())
+		stream << "!qpmx_sub_pri|";
+	stream << "!contains(QPMX_INCLUDE_GUARDS, \"" << package << "\") {\n"
+		   << "\tQPMX_INCLUDE_GUARDS += \"" << package << "\"\n"
+		   << "\tINCLUDEPATH += \"" << dir.absoluteFilePath(QStringLiteral("include")) << "\"\n";
+	if(dir.exists(QStringLiteral("translations")))
+		stream << "\tQPMX_TS_DIRS += \"" << dir.absoluteFilePath(QStringLiteral("translations")) << "\"\n";
+
+	auto libName = meta[QStringLiteral("lib")].toString();
+	if(!libName.isEmpty()) {
+		if(_prelink) {
+			_prelinkInputs.append({
+				dir.absoluteFilePath(QStringLiteral("lib/lib%1.a").arg(libName)),
+				artifactKey(dir)
+			});
+			stream << "\t!qpmx_prelinked {\n";
+			CompileCommand::writeLibLines(stream, dir.absolutePath(), libName, true, QStringLiteral("\t\t"));
+			stream << "\t}\n";
+		} else
+			CompileCommand::writeLibLines(stream, dir.absolutePath(), libName, true);
+	}
+	auto hooks = meta[QStringLiteral("hooks")].toVariant().toStringList();
+	if(!hooks.isEmpty())
+		stream << "\tQPMX_STARTUP_HOOKS += \"" << hooks.join(QStringLiteral("\" \"")) << "\"\n";
+	auto resources = meta[QStringLiteral("resources")].toVariant().toStringList();
+	if(!resources.isEmpty())
+		stream << "\tQPMX_RESOURCE_FILES += \"" << resources.join(QStringLiteral("\" \"")) << "\"\n";
+	auto deferredHooks = meta[QStringLiteral("deferredHooks")].toVariant().toStringList();
+	if(!deferredHooks.isEmpty())
+		stream << "\tQPMX_DEFERRED_HOOKS += \"" << deferredHooks.join(QStringLiteral("\" \"")) << "\"\n";
+	auto deferredResources = meta[QStringLiteral("deferredResources")].toVariant().toStringList();
+	if(!deferredResources.isEmpty())
+		stream << "\tQPMX_DEFERRED_RESOURCES += \"" << deferredResources.join(QStringLiteral("\" \"")) << "\"\n";
+	auto prcFile = meta[QStringLiteral("prcFile")].toString();
+	if(!prcFile.isEmpty()) {
+		stream << "\tQPMX_INSTALL_DIR=" << dir.absolutePath() << "\n"
+			   << "\tinclude(" << prcFile << ")\n"
+			   << "\tQPMX_INSTALL_DIR=\n";
+	}
+	stream << "}\n";
+
+	return true;
+}
+
+QString GenerateCommand::prelink()
+{
+	//the host ld only links objects of the host architecture - cross and multilib kits have a different xspec
+	auto supported = false;
+#ifdef Q_OS_LINUX
+	for(const auto &kit : QtKitInfo::readFromSettings(buildDir())) {
+		if(BuildId{kit.id} == _kitId) {
+			supported = kit.xspec.startsWith(QStringLiteral("linux")) &&
+						kit.xspec == kit.spec &&
+						kit.sysRoot.isEmpty();
+		}
+	}
+#endif
+	auto ld = QStandardPaths::findExecutable(QStringLiteral("ld"));
+	if(!supported || ld.isEmpty()) {
+		xWarning() << tr("Prelinking is only supported for native linux kits with ld in the PATH. Linking the libraries instead");
+		return {};
+	}
+
+	//one object per project, kit and resolved set of package builds
+	auto projectKey = QString::fromLatin1(QCryptographicHash::hash(_genPath.toUtf8(), QCryptographicHash::Sha256).toHex().left(16));
+	QCryptographicHash hash{QCryptographicHash::Sha256};
+	hash.addData(_kitId.toUtf8());
+	for(const auto &input : qAsConst(_prelinkInputs)) {
+		hash.addData("\n", 1);
+		hash.addData(input.first.toUtf8());
+		hash.addData(":", 1);
+		hash.addData(input.second);
+	}
+	auto pDir = buildDir(_kitId);
+	if(!pDir.mkpath(QStringLiteral(".prelinked")) || !pDir.cd(QStringLiteral(".prelinked")))
+		throw tr("Failed to create prelink cache directory");
+	auto objName = projectKey + QLatin1Char('-') + QString::fromLatin1(hash.result().toHex()) + QStringLiteral(".o");
+	auto objPath = pDir.absoluteFilePath(objName);
+	if(QFile::exists(objPath)) {
+		xDebug() << tr("Using cached prelinked object");
+		return objPath;
+	}
+
+	//whole archives keep startup hooks and resources that nothing references directly
+	auto tmpPath = objPath + QLatin1Char('.') + BuildId{QUuid::createUuid()};
+	QStringList args {
+		QStringLiteral("-r"),
+		QStringLiteral("-o"),
+		tmpPath,
+		QStringLiteral("--whole-archive")
+	};
+	for(const auto &input : qAsConst(_prelinkInputs))
+		args.append(input.first);
+	args.append(QStringLiteral("--no-whole-archive"));
+
+	xInfo() << tr("Prelinking %n package(s)", "", _prelinkInputs.size());
+	QProcess process;
+	process.setProgram(ld);
+	process.setArguments(args);
+	process.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+	if(QtCoroutine::await(&process) != EXIT_SUCCESS || process.exitStatus() != QProcess::NormalExit) {
+		QFile::remove(tmpPath);
+		xWarning() << tr("Failed to prelink package libraries. Linking the libraries instead");
+		return {};
+	}
+
+	//a concurrent run may have created the same object already
+	if(!QFile::rename(tmpPath, objPath)) {
+		QFile::remove(tmpPath);
+		if(!QFile::exists(objPath))
+			throw tr("Failed to move prelinked object into the cache");
+	}
+
+	//objects of previous package builds are only referenced by this project, which now uses the new one
+	for(const auto &oldObj : pDir.entryList({projectKey + QStringLiteral("-*.o")}, QDir::Files)) {
+		if(oldObj != objName && !pDir.remove(oldObj))
+			xDebug() << tr("Failed to remove stale prelinked object %1").arg(oldObj);
+	}
+	return objPath;
 }
@@ -2,6 +2,9 @@
 #define GENERATECOMMAND_H
 
 #include "command.h"
+#include "topsort.h"
+
+#include <QTextStream>
 
 class GenerateCommand : public Command
 {
@@ -14,18 +17,28 @@ public:
 	QString commandDescription() const override;
 	QSharedPointer<QCliNode> createCliNode() const override;
 
+	void generate(const QString &outdir, const QString &qmake, bool recreate, bool flat = false, bool prelink = false);
+
 protected slots:
 	void initialize(QCliParser &parser) override;
 
 private:
-	QFile *_genFile;
+	QString _genPath;
 	QString _qmake;
+	BuildId _kitId;
+	bool _flat = false;
+	bool _prelink = false;
+	QList<QPair<QString, QByteArray>> _prelinkInputs;
 
 	BuildId kitId(const QpmxUserFormat &format) const;
-	QpmxCacheFormat cachedFormat(const QpmxUserFormat &format) const;
-
-	bool hasChanged(const QpmxUserFormat &currentUser, const QpmxCacheFormat &cache);
-	void createPriFile(const QpmxUserFormat &current);
+	QByteArray fingerprint(const QpmxUserFormat &format) const;
+
+	bool createPriFile(const QpmxUserFormat &current);
+	TopSort<QpmxDevDependency, qpmx::PackageInfo> depGraph(const QpmxUserFormat &current);
+	bool orderedIncludes(const QpmxUserFormat &current);
+	bool writeFlatDeps(QTextStream &stream, const QpmxUserFormat &current);
+	bool writeFlatPackage(QTextStream &stream, const QpmxUserFormat &current, const QpmxDevDependency &dep);
+	QString prelink();
 };
 
 #endif // GENERATECOMMAND_H
@@ -1,5 +1,6 @@
 #include "hookcommand.h"
 
+#include <QBuffer>
 #include <QCryptographicHash>
 using namespace qpmx;
 
@@ -26,15 +27,21 @@ QSharedPointer<QCliNode> HookCommand::createCliNode() const
 							tr("Generate the special sources for given <source> as outfile."),
 							tr("source")
 						});
+	hookNode->addOption({
+							QStringLiteral("table"),
+							tr("Generate a hook table that can time the hooks and runs deferred hooks and resources "
+							   "after the first event loop iteration.")
+						});
 	hookNode->addOption({
 							{QStringLiteral("o"), QStringLiteral("out")},
 							tr("The <path> of the file to be generated (required!)."),
 							tr("path")
 						});
 	hookNode->addPositionalArgument(QStringLiteral("hook_ids"),
-									tr("The ids of the hooks to be added to the hookup. Typically defined by the "
-									   "QPMX_STARTUP_HASHES qmake variable."),
-									QStringLiteral("[<hook_id> ...]"));
+									tr("The ids of the hooks to be added to the hookup, followed by the resources, the deferred "
+									   "hooks and the deferred resources, each separated by %%. Typically defined by the "
+									   "QPMX_STARTUP_HOOKS and related qmake variables."),
+									QStringLiteral("[<hook_id> ...] [%% <resource> ...] [%% <hook_id> ...] [%% <resource> ...]"));
 	return hookNode;
 }
 
@@ -45,57 +52,192 @@ void HookCommand::initialize(QCliParser &parser)
 		if(outFile.isEmpty())
 			throw tr("You must specify the name of the file to generate as --out option");
 
-		QFile out(outFile);
-		if(!out.open(QIODevice::WriteOnly | QIODevice::Text)) {
-			throw tr("Failed to create %1 file with error: %2")
-					.arg(out.fileName(), out.errorString());
-		}
-
+		QBuffer out;
+		out.open(QIODevice::WriteOnly);
 		if(parser.isSet(QStringLiteral("prepare")))
 			createHookCompile(parser.value(QStringLiteral("prepare")), &out);
 		else
-			createHookSrc(parser.positionalArguments(), &out);
-
+			createHookSrc(parser.positionalArguments(), parser.isSet(QStringLiteral("table")), &out);
 		out.close();
-		qApp->quit();
+
+		//an unchanged hook file must not trigger a recompilation
+		if(!writeIfChanged(outFile, out.data()))
+			xDebug() << tr("%1 is unchanged").arg(outFile);
+		quit();
 	} catch (QString &s) {
 		xCritical() << s;
 	}
 }
 
-void HookCommand::createHookSrc(const QStringList &args, QIODevice *out)
+void HookCommand::createHookSrc(const QStringList &args, bool table, QIODevice *out)
 {
-	bool sep = false;
+	//hooks %% resources %% deferred hooks %% deferred resources - resources are qrc names or external rcc files
 	QRegularExpression replaceRegex(QStringLiteral(R"__([\.-])__"));
-	QStringList hooks;
-	QStringList resources;
+	QList<QStringList> sections {{}, {}, {}, {}};
+	auto section = 0;
 	for(auto arg : args) {
-		if(sep)
-			resources.append(arg.replace(replaceRegex, QStringLiteral("_")));
-		else if(arg == QStringLiteral("%%"))
-			sep = true;
+		if(arg == QStringLiteral("%%") && section < sections.size() - 1)
+			section++;
+		else if(section % 2 == 1 && !arg.endsWith(QStringLiteral(".rcc")))
+			sections[section].append(arg.replace(replaceRegex, QStringLiteral("_")));
 		else
-			hooks.append(arg);
+			sections[section].append(arg);
+	}
+	auto splitRcc = [](QStringList &resources) {
+		QStringList rccFiles;
+		for(auto it = resources.begin(); it != resources.end();) {
+			if(it->endsWith(QStringLiteral(".rcc"))) {
+				rccFiles.append(*it);
+				it = resources.erase(it);
+			} else
+				it++;
+		}
+		return rccFiles;
+	};
+	auto hooks = sections[0];
+	auto resources = sections[1];
+	auto rccFiles = splitRcc(resources);
+	auto deferredHooks = sections[2];
+	auto deferredResources = sections[3];
+	auto deferredRccFiles = splitRcc(deferredResources);
+
+	//without a table, everything runs eagerly
+	if(!table) {
+		hooks.append(deferredHooks);
+		resources.append(deferredResources);
+		rccFiles.append(deferredRccFiles);
+		deferredHooks.clear();
+		deferredResources.clear();
+		deferredRccFiles.clear();
 	}
 
 	xDebug() << tr("Creating hook file");
 	QTextStream stream(out);
-	stream << "#include <QtCore/QCoreApplication>\n\n"
-		   << "namespace __qpmx_startup_hooks {\n";
-	for(const auto &hook : hooks)
+	stream << "#include <QtCore/QCoreApplication>\n";
+	if(!rccFiles.isEmpty() || !deferredRccFiles.isEmpty())
+		stream << "#include <QtCore/QResource>\n";
+	if(table) {
+		stream << "#include <QtCore/QElapsedTimer>\n"
+			   << "#include <QtCore/QTimer>\n";
+	}
+	stream << "\nnamespace __qpmx_startup_hooks {\n";
+	for(const auto &hook : hooks + deferredHooks)
 		stream << "\tvoid hook_" << hook << "();\n";
 	stream << "}\n\n";
-	stream << "using namespace __qpmx_startup_hooks;\n"
-		   << "static void __qpmx_root_hook() {\n";
-	for(const auto &resource : resources)
-		stream << "\tQ_INIT_RESOURCE(" << resource << ");\n";
-	for(const auto &hook : hooks)
-		stream << "\thook_" << hook << "();\n";
-	stream << "}\n"
-		   << "Q_CONSTRUCTOR_FUNCTION(__qpmx_root_hook)\n";
+	stream << "using namespace __qpmx_startup_hooks;\n";
+
+	//external resources are memory mapped - a copy deployed next to the application is preferred over the cache
+	QList<HookEntry> rccEntries;
+	QList<HookEntry> deferredRccEntries;
+	if(!rccFiles.isEmpty() || !deferredRccFiles.isEmpty()) {
+		stream << "static void __qpmx_register_rcc(const char *fileName, const char *cachePath) {\n"
+			   << "\tif(!QResource::registerResource(QCoreApplication::applicationDirPath() + QLatin1Char('/') + QLatin1String(fileName)) &&\n"
+			   << "\t   !QResource::registerResource(QString::fromUtf8(cachePath)))\n"
+			   << "\t\tqWarning(\"qpmx: Failed to register external resource %s\", fileName);\n"
+			   << "}\n";
+		auto index = 0;
+		for(const auto &rccFile : rccFiles + deferredRccFiles) {
+			auto fnName = QStringLiteral("__qpmx_rcc_%1").arg(index++);
+			stream << "static void " << fnName << "() {\n"
+				   << "\t__qpmx_register_rcc(\"" << QFileInfo(rccFile).fileName() << "\", \"" << rccFile << "\");\n"
+				   << "}\n";
+			if(rccEntries.size() < rccFiles.size())
+				rccEntries.append({QStringLiteral("resource ") + QFileInfo(rccFile).fileName(), fnName});
+			else
+				deferredRccEntries.append({QStringLiteral("resource ") + QFileInfo(rccFile).fileName(), fnName});
+		}
+	}
+
+	if(table) {
+		//Q_INIT_RESOURCE must be used from the global namespace
+		auto resourceEntries = [&](const QStringList &names) {
+			QList<HookEntry> entries;
+			for(const auto &resource : names) {
+				stream << "static void __qpmx_resource_" << resource << "() {\n"
+					   << "\tQ_INIT_RESOURCE(" << resource << ");\n"
+					   << "}\n";
+				entries.append({QStringLiteral("resource ") + resource, QStringLiteral("__qpmx_resource_") + resource});
+			}
+			return entries;
+		};
+		auto hookEntries = [](const QStringList &ids) {
+			QList<HookEntry> entries;
+			for(const auto &hook : ids)
+				entries.append({QStringLiteral("hook ") + hook, QStringLiteral("hook_") + hook});
+			return entries;
+		};
+		auto staticEntries = resourceEntries(resources);
+		auto deferredEntries = resourceEntries(deferredResources) + deferredRccEntries + hookEntries(deferredHooks);
+		createHookTable(stream, staticEntries, rccEntries + hookEntries(hooks), deferredEntries);
+	} else {
+		if(!rccEntries.isEmpty()) {
+			stream << "static void __qpmx_rcc_hook() {\n";
+			for(const auto &entry : qAsConst(rccEntries))
+				stream << "\t" << entry.second << "();\n";
+			stream << "}\n";
+		}
+		stream << "static void __qpmx_root_hook() {\n";
+		for(const auto &resource : resources)
+			stream << "\tQ_INIT_RESOURCE(" << resource << ");\n";
+		for(const auto &hook : hooks)
+			stream << "\thook_" << hook << "();\n";
+		if(!rccEntries.isEmpty())
+			stream << "\tqAddPreRoutine(__qpmx_rcc_hook);\n";
+		stream << "}\n";
+	}
+	stream << "Q_CONSTRUCTOR_FUNCTION(__qpmx_root_hook)\n";
 	stream.flush();
 }
 
+void HookCommand::createHookTable(QTextStream &stream, const QList<HookEntry> &staticEntries, const QList<HookEntry> &appEntries, const QList<HookEntry> &deferredEntries)
+{
+	auto writeTable = [&](const char *name, const QList<HookEntry> &entries) {
+		stream << "\nstatic const __qpmx_hook_entry " << name << "[] = {\n";
+		for(const auto &entry : entries)
+			stream << "\t{\"" << entry.first << "\", &" << entry.second << "},\n";
+		stream << "\t{nullptr, nullptr}\n"
+			   << "};\n";
+	};
+	stream << "\nstruct __qpmx_hook_entry {\n"
+		   << "\tconst char *name;\n"
+		   << "\tvoid (*fn)();\n"
+		   << "};\n";
+	writeTable("__qpmx_resource_table", staticEntries);
+	writeTable("__qpmx_hook_table", appEntries);
+	writeTable("__qpmx_deferred_table", deferredEntries);
+
+	//hooks only register their function via qAddPreRoutine - within a pre routine, that calls it immediately
+	stream << "\nstatic void __qpmx_run_hooks(const __qpmx_hook_entry *entry) {\n"
+		   << "\tstatic const bool timed = qEnvironmentVariableIsSet(\"QPMX_HOOK_TIMING\");\n"
+		   << "\tfor(; entry->fn; ++entry) {\n"
+		   << "\t\tif(timed) {\n"
+		   << "\t\t\tQElapsedTimer timer;\n"
+		   << "\t\t\ttimer.start();\n"
+		   << "\t\t\tentry->fn();\n"
+		   << "\t\t\tqInfo(\"qpmx startup %s took %lld us\", entry->name, static_cast<long long>(timer.nsecsElapsed() / 1000));\n"
+		   << "\t\t} else\n"
+		   << "\t\t\tentry->fn();\n"
+		   << "\t}\n"
+		   << "}\n\n"
+		   << "namespace qpmx {\n"
+		   << "\tvoid runDeferredStartupHooks() {\n"
+		   << "\t\tstatic bool done = false;\n"
+		   << "\t\tif(done)\n"
+		   << "\t\t\treturn;\n"
+		   << "\t\tdone = true;\n"
+		   << "\t\t__qpmx_run_hooks(__qpmx_deferred_table);\n"
+		   << "\t}\n"
+		   << "}\n\n"
+		   << "static void __qpmx_app_hook() {\n"
+		   << "\t__qpmx_run_hooks(__qpmx_hook_table);\n"
+		   << "\tQTimer::singleShot(0, qApp, &qpmx::runDeferredStartupHooks);\n"
+		   << "}\n\n"
+		   << "static void __qpmx_root_hook() {\n"
+		   << "\t__qpmx_run_hooks(__qpmx_resource_table);\n"
+		   << "\tqAddPreRoutine(__qpmx_app_hook);\n"
+		   << "}\n";
+}
+
 void HookCommand::createHookCompile(const QString &inFile, QIODevice *out)
 {
 	xDebug() << tr("Scanning %1 for startup hooks").arg(inFile);
@@ -124,11 +266,10 @@ void HookCommand::createHookCompile(const QString &inFile, QIODevice *out)
 	QDir hookDir(QStringLiteral(".qpmx_startup_hooks"));
 	if(!hookDir.mkpath(QStringLiteral(".")))
 		throw tr("Failed to create hook directory");
-	QFile hookFile(hookDir.absoluteFilePath(QFileInfo(inFile).fileName()));
+	auto hookPath = hookDir.absoluteFilePath(QFileInfo(inFile).fileName());
 	if(!functions.isEmpty()) {
-		if(!hookFile.open(QIODevice::WriteOnly | QIODevice::Text))
-			throw tr("Failed to create qpmx hook cache with error: %1").arg(hookFile.errorString());
-		QTextStream hookStream(&hookFile);
+		QByteArray hookData;
+		QTextStream hookStream(&hookData);
 
 		stream << "\nnamespace __qpmx_startup_hooks {";
 		for(const auto &fn : functions) {
@@ -137,14 +278,14 @@ void HookCommand::createHookCompile(const QString &inFile, QIODevice *out)
 			stream << "\n\tvoid hook_" << fnId << "() {\n"
 				   << "\t\t" << fn << "_ctor_function();\n"
 				   << "\t}\n";
-			hookStream << fnId << "\n";
+			hookStream << fnId << " " << fn.trimmed() << "\n";
 		}
 		stream << "}\n";
 
 		hookStream.flush();
-		hookFile.close();
+		writeIfChanged(hookPath, hookData);
 	} else
-		hookFile.remove();
+		QFile::remove(hookPath);
 
 	stream.flush();
 }
@@ -3,6 +3,8 @@
 
 #include "command.h"
 
+#include <QTextStream>
+
 class HookCommand : public Command
 {
 	Q_OBJECT
@@ -18,8 +20,14 @@ protected slots:
 	void initialize(QCliParser &parser) override;
 
 private:
-	void createHookSrc(const QStringList &args, QIODevice *out);
+	using HookEntry = QPair<QString, QString>; //(display name, function)
+
+	void createHookSrc(const QStringList &args, bool table, QIODevice *out);
 	void createHookCompile(const QString &inFile, QIODevice *out);
+	void createHookTable(QTextStream &stream,
+						 const QList<HookEntry> &staticEntries,
+						 const QList<HookEntry> &appEntries,
+						 const QList<HookEntry> &deferredEntries);
 };
 
 #endif // HOOKCOMMAND_H
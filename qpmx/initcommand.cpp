@@ -1,4 +1,11 @@
 #include "initcommand.h"
+#include "installcommand.h"
+#include "compilecommand.h"
+#include "generatecommand.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QSaveFile>
 using namespace qpmx;
 
 InitCommand::InitCommand(QObject *parent) :
@@ -35,6 +42,16 @@ QSharedPointer<QCliNode> InitCommand::createCliNode() const
 							tr("Pass the --clean cli flag to the compile step. This will generate clean dev "
 							   "builds instead of caching them for speeding builds up."),
 						});
+	initNode->addOption({
+							QStringLiteral("flat"),
+							tr("Pass the --flat cli flag to the generate step. This will write all dependencies into "
+							   "a single pri file instead of including the include.pri of every package."),
+						});
+	initNode->addOption({
+							QStringLiteral("prelink"),
+							tr("Pass the --prelink cli flag to the generate step. This will link applications against "
+							   "a single prelinked object of all packages instead of the libraries."),
+						});
 	initNode->addOption({
 							QStringLiteral("qpmx-prepare"),
 							tr("Prepare the given <pro-file> by adding the qpmx initializations lines. By using this "
@@ -106,16 +123,18 @@ void InitCommand::initialize(QCliParser &parser)
 	try {
 		if(parser.isSet(QStringLiteral("qpmx-prepare"))) {
 			prepare(parser.value(QStringLiteral("qpmx-prepare")));
-			qApp->quit();
+			quit();
 			return;
 		}
 		if(parser.isSet(QStringLiteral("ts-prepare"))) {
 			tsPrepare(parser.value(QStringLiteral("ts-prepare")));
-			qApp->quit();
+			quit();
 			return;
 		}
 
 		auto reRun = parser.isSet(QStringLiteral("r"));
+		auto flat = parser.isSet(QStringLiteral("flat"));
+		auto prelink = parser.isSet(QStringLiteral("prelink"));
 
 		if(parser.positionalArguments().size() != 2) {
 			throw tr("Invalid arguments! You must specify the qmake path to use for compilation "
@@ -124,45 +143,166 @@ void InitCommand::initialize(QCliParser &parser)
 		auto qmake = parser.positionalArguments().value(0);
 		auto outdir = parser.positionalArguments().value(1);
 
-		//run install
-		QStringList runArgs {
-			QStringLiteral("install")
-		};
-		if(reRun)
-			runArgs.append(QStringLiteral("--renew"));
-		subCall(runArgs);
-		xDebug() << tr("Successfully ran install step");
-
-		//run compile
-		runArgs = QStringList {
-			QStringLiteral("compile"),
-			QStringLiteral("--qmake"),
-			qmake
-		};
-		if(reRun)
-			runArgs.append(QStringLiteral("--recompile"));
-		if(parser.isSet(QStringLiteral("stderr")))
-			runArgs.append(QStringLiteral("--stderr"));
-		if(parser.isSet(QStringLiteral("clean")))
-			runArgs.append(QStringLiteral("--clean"));
-		subCall(runArgs);
-		xDebug() << tr("Successfully ran compile step");
+		//fast path: nothing that influences the result changed since the last successful run
+		QDir outDir{outdir};
+		auto stampPath = outDir.absoluteFilePath(QStringLiteral(".qpmx.init-stamp"));
+		QByteArray pKey;
+		if(!reRun && !QpmxUserFormat::readDefault(true).hasDevOptions()) {
+			pKey = projectKey(qmake);
+			QFile stampFile{stampPath};
+			if(outDir.exists(QStringLiteral("qpmx_generated.pri")) &&
+			   stampFile.open(QIODevice::ReadOnly) &&
+			   stampFile.readAll() == initStamp(pKey, qmake, outDir, flat, prelink)) {
+				xDebug() << tr("Unchanged project configuration. Skipping initialization");
+				quit();
+				return;
+			}
+		}
+		if(QFile::exists(stampPath) && !QFile::remove(stampPath))
+			throw tr("Failed to remove outdated init stamp \"%1\"").arg(stampPath);
+
+		auto fwdStderr = parser.isSet(QStringLiteral("stderr"));
+		auto clean = parser.isSet(QStringLiteral("clean"));
+		//an explicit clean must always run, so it is never coalesced
+		if(pKey.isEmpty() || clean)
+			runSteps(qmake, reRun, fwdStderr, clean);
+		else {
+			//sibling projects with the same configuration wait for the first one and reuse its result
+			auto _il = initLock(QString::fromLatin1(pKey));
+			auto format = QpmxUserFormat::readDefault(true);
+			QDir markerDir{cacheDir().absoluteFilePath(QStringLiteral("init"))};
+			QFile doneFile{markerDir.absoluteFilePath(QString::fromLatin1(pKey) + QStringLiteral(".done"))};
+			if(doneFile.open(QIODevice::ReadOnly) &&
+			   QString::fromUtf8(doneFile.readAll()) == projectArtifacts(format, kitId(format, qmake))) {
+				doneFile.close();
+				xDebug() << tr("Project was already initialized by a concurrent run. Skipping install and compile steps");
+			} else {
+				doneFile.close();
+				runSteps(qmake, reRun, fwdStderr, clean);
+				if(failed())
+					return;
+				if(!markerDir.mkpath(QStringLiteral(".")))
+					xWarning() << tr("Failed to create init marker directory");
+				else {
+					QSaveFile saveFile{doneFile.fileName()};
+					if(!saveFile.open(QIODevice::WriteOnly) ||
+					   saveFile.write(projectArtifacts(format, kitId(format, qmake)).toUtf8()) == -1 ||
+					   !saveFile.commit())
+						xWarning() << tr("Failed to write init marker with error: %1").arg(saveFile.errorString());
+					removeStaleMarkers(markerDir);
+				}
+			}
+		}
+		if(failed())
+			return;
 
 		//run generate
-		runArgs = QStringList {
-			QStringLiteral("generate"),
-			QStringLiteral("--qmake"),
-			qmake,
-			outdir
-		};
-		if(reRun)
-			runArgs.append(QStringLiteral("--recreate"));
-		subCall(runArgs);
+		{
+			GenerateCommand generate;
+			generate.setupFrom(*this);
+			generate.generate(outdir, qmake, reRun, flat, prelink);
+		}
+		if(failed())
+			return;
 		xDebug() << tr("Successfully ran generate step");
 
+		if(!pKey.isEmpty()) {
+			//recalculate, as the steps have built or replaced packages
+			QSaveFile stampFile{stampPath};
+			if(!stampFile.open(QIODevice::WriteOnly) ||
+			   stampFile.write(initStamp(pKey, qmake, outDir, flat, prelink)) == -1 ||
+			   !stampFile.commit())
+				xWarning() << tr("Failed to write init stamp with error: %1").arg(stampFile.errorString());
+		}
+
 		xDebug() << tr("Completed qpmx initialization");
-		qApp->quit();
+		quit();
 	} catch (QString &s) {
 		xCritical() << s;
 	}
 }
+
+void InitCommand::runSteps(const QString &qmake, bool reRun, bool fwdStderr, bool clean)
+{
+	//run install
+	{
+		InstallCommand install;
+		install.setupFrom(*this);
+		install.installProject(reRun);
+	}
+	if(failed())
+		return;
+	xDebug() << tr("Successfully ran install step");
+
+	//run compile
+	{
+		CompileCommand compile;
+		compile.setupFrom(*this);
+		compile.compileProject(qmake, reRun, fwdStderr, clean);
+	}
+	if(failed())
+		return;
+	xDebug() << tr("Successfully ran compile step");
+}
+
+QByteArray InitCommand::projectKey(const QString &qmake) const
+{
+	QCryptographicHash hash{QCryptographicHash::Sha256};
+	auto addData = [&](const QByteArray &data) {
+		hash.addData(QByteArray::number(data.size()));
+		hash.addData(":", 1);
+		hash.addData(data);
+	};
+	auto addFile = [&](const QString &path) {
+		QFile file{path};
+		if(file.open(QIODevice::ReadOnly))
+			addData(file.readAll());
+		else
+			addData({});
+	};
+
+	addData(QCoreApplication::applicationVersion().toUtf8());
+	addFile(QDir::current().absoluteFilePath(QStringLiteral("qpmx.json")));
+	addFile(QDir::current().absoluteFilePath(QStringLiteral("qpmx.json.user")));
+	QFileInfo qmakeInfo{qmake};
+	addData(qmakeInfo.canonicalFilePath().toUtf8());
+	addData(QByteArray::number(qmakeInfo.lastModified().toMSecsSinceEpoch()));
+	addData(QByteArray::number(qmakeInfo.size()));
+	return hash.result().toHex();
+}
+
+QByteArray InitCommand::initStamp(const QByteArray &projectKey, const QString &qmake, const QDir &outDir, bool flat, bool prelink) const
+{
+	//only the packages of this project matter - changes of the cache for other projects must not invalidate the stamp
+	auto format = QpmxUserFormat::readDefault(true);
+
+	QCryptographicHash hash{QCryptographicHash::Sha256};
+	hash.addData(projectKey);
+	hash.addData("\n", 1);
+	hash.addData(flat ? "flat" : "nested");
+	hash.addData("\n", 1);
+	hash.addData(prelink ? "prelink" : "archives");
+	hash.addData("\n", 1);
+	hash.addData(projectArtifacts(format, kitId(format, qmake)).toUtf8());
+	hash.addData("\n", 1);
+	hash.addData(outDir.absolutePath().toUtf8());
+	return hash.result().toHex();
+}
+
+Command::BuildId InitCommand::kitId(const QpmxUserFormat &format, const QString &qmake) const
+{
+	if(format.source)
+		return QStringLiteral("src");
+	else
+		return QtKitInfo::findKitId(buildDir(), qmake);
+}
+
+void InitCommand::removeStaleMarkers(const QDir &markerDir) const
+{
+	//markers only serve runs that wait for a concurrent init - the init stamp covers everything else
+	auto limit = QDateTime::currentDateTime().addDays(-1);
+	for(const auto &marker : markerDir.entryInfoList({QStringLiteral("*.done")}, QDir::Files)) {
+		if(marker.lastModified() < limit && !QFile::remove(marker.absoluteFilePath()))
+			xDebug() << tr("Failed to remove stale init marker %1").arg(marker.fileName());
+	}
+}
@@ -21,7 +21,11 @@ protected slots:
 	void initialize(QCliParser &parser) override;
 
 private:
-	void exec(const QString &step, const QStringList &arguments);
+	QByteArray projectKey(const QString &qmake) const;
+	QByteArray initStamp(const QByteArray &projectKey, const QString &qmake, const QDir &outDir, bool flat, bool prelink) const;
+	BuildId kitId(const QpmxUserFormat &format, const QString &qmake) const;
+	void runSteps(const QString &qmake, bool reRun, bool fwdStderr, bool clean);
+	void removeStaleMarkers(const QDir &markerDir) const;
 };
 
 #endif // INITCOMMAND_H
@@ -2,7 +2,9 @@
 #include "installcommand.h"
 #include <QDebug>
 #include <QStandardPaths>
-#include <qtcoroutine.h>
+#include <QMap>
+#include <vector>
+#include <algorithm>
 using namespace qpmx;
 
 InstallCommand::InstallCommand(QObject *parent) :
@@ -56,88 +58,253 @@ void InstallCommand::initialize(QCliParser &parser)
 			_pkgList = devDepList(readCliPackages(parser.positionalArguments()));
 			if(!cacheOnly)
 				_addPkgCount = _pkgList.size();
-		} else {
-			auto format = QpmxUserFormat::readDefault(true);
-			_pkgList = format.allDeps();
-			_aliases = format.devAliases;
-			if(_pkgList.isEmpty()) {
-				xWarning() << tr("No dependencies found in qpmx.json. Nothing will be done");
-				qApp->quit();
-				return;
-			}
-			if(format.hasDevOptions())
-				setDevMode(true);
-
-			xDebug() << tr("Installing %n package(s) from qpmx.json file", "", _pkgList.size());
+		} else if(!loadProject()) {
+			quit();
+			return;
 		}
 
 		getPackages();
+		quit();
 	} catch(QString &s) {
 		xCritical() << s;
 	}
 }
 
+void InstallCommand::installProject(bool renew)
+{
+	_renew = renew;
+	if(loadProject())
+		getPackages();
+}
+
+bool InstallCommand::loadProject()
+{
+	auto format = QpmxUserFormat::readDefault(true);
+	_pkgList = format.allDeps();
+	_aliases = aliasMap(format.devAliases);
+	if(_pkgList.isEmpty()) {
+		xWarning() << tr("No dependencies found in qpmx.json. Nothing will be done");
+		return false;
+	}
+	if(format.hasDevOptions())
+		setDevMode(true);
+
+	xDebug() << tr("Installing %n package(s) from qpmx.json file", "", _pkgList.size());
+	return true;
+}
+
 void InstallCommand::getPackages()
 {
-	for(auto i = 0; i < _pkgList.size(); ++i) {
-		auto &currentDep = _pkgList[i];
-		if(currentDep.isDev() && !currentDep.isComplete())
-			throw tr("dev dependencies cannot be used without a provider/version");
-
-		// first: find the correct version if nothing but the name was specified
-		// this will either yield a single package, set to currentDep, or fail in an exception
-		if(currentDep.version.isNull() && currentDep.provider.isEmpty()) {
-			const auto allProvs = registry()->providerNames();
-			QList<QpmxDevDependency> foundDeps;
-			foundDeps.reserve(allProvs.size());
-			QtCoroutine::awaitEach(allProvs, [this, currentDep, &foundDeps](const QString &prov) {
-				auto plugin = registry()->sourcePlugin(prov);
-				if(plugin->packageValid(currentDep.pkg(prov))) {
+	//install in waves: each wave installs all packages known so far, the dependencies they detect form the next wave
+	_pkgPlan.clear();
+	_pkgPlan.reserve(_pkgList.size());
+	for(const auto &dep : qAsConst(_pkgList))
+		planPackage(dep);
+
+	auto done = 0;
+	while(done < _pkgList.size()) {
+		const auto end = _pkgList.size();
+		prefetch(done, end);
+		TaskGroup group{this};
+		for(auto i = done; i < end; ++i) {
+			auto currentDep = _pkgList[i];
+			group.run(currentDep.provider, [this, i, currentDep]() mutable {
+				getPackage(currentDep);
+				updatePackage(i, currentDep);
+			});
+		}
+		group.wait();
+		done = end;
+	}
+
+	if(_addPkgCount > 0)
+		completeInstall();
+	else
+		xDebug() << tr("Skipping add to qpmx.json, only cache installs");
+	xDebug() << tr("Package installation completed");
+}
+
+void InstallCommand::getPackage(QpmxDevDependency &currentDep)
+{
+	if(currentDep.isDev() && !currentDep.isComplete())
+		throw tr("dev dependencies cannot be used without a provider/version");
+
+	// first: find the correct version if nothing but the name was specified
+	// this will either yield a single package, set to currentDep, or fail in an exception
+	if(currentDep.version.isNull() && currentDep.provider.isEmpty()) {
+		//the tasks only share the result list, never the stack of this call
+		auto foundDeps = QSharedPointer<QList<QpmxDevDependency>>::create();
+		TaskGroup group{this};
+		for(const auto &prov : registry()->providerNames()) {
+			auto plugin = registry()->sourcePlugin(prov);
+			if(plugin->packageValid(currentDep.pkg(prov))) {
+				group.run(prov, [this, plugin, prov, currentDep, foundDeps](){
 					auto cpDep = currentDep;
 					cpDep.provider = prov;
 					if(getVersion(cpDep, plugin, false))
-						foundDeps.append(cpDep);
-				}
-			});
-			verifyDeps(foundDeps, currentDep);
-			currentDep = foundDeps.takeFirst();
+						foundDeps->append(cpDep);
+				});
+			}
 		}
+		group.wait();
+		verifyDeps(*foundDeps, currentDep);
+		currentDep = foundDeps->takeFirst();
+	}
 
-		// second: provider is not set (but version is)
-		if(currentDep.provider.isEmpty()) {
-			Q_ASSERT(!currentDep.version.isNull());
-			const auto allProvs = registry()->providerNames();
-			QList<QpmxDevDependency> foundDeps;
-			foundDeps.reserve(allProvs.size());
-			QtCoroutine::awaitEach(allProvs, [this, currentDep, &foundDeps](const QString &prov) {
-				auto plugin = registry()->sourcePlugin(prov);
-				if(plugin->packageValid(currentDep.pkg(prov))) {
+	// second: provider is not set (but version is)
+	if(currentDep.provider.isEmpty()) {
+		Q_ASSERT(!currentDep.version.isNull());
+		auto foundDeps = QSharedPointer<QList<QpmxDevDependency>>::create();
+		TaskGroup group{this};
+		for(const auto &prov : registry()->providerNames()) {
+			auto plugin = registry()->sourcePlugin(prov);
+			if(plugin->packageValid(currentDep.pkg(prov))) {
+				group.run(prov, [this, plugin, prov, currentDep, foundDeps](){
 					auto cpDep = currentDep;
 					cpDep.provider = prov;
 					if(installPackage(cpDep, plugin, false))
-						foundDeps.append(cpDep);
-				}
-			});
-			verifyDeps(foundDeps, currentDep);
-			currentDep = foundDeps.takeFirst();
-		} else { // third: provider provider set, version may or may not be set
-			Q_ASSERT(!currentDep.provider.isEmpty());
-			auto plugin = registry()->sourcePlugin(currentDep.provider);
-			if(!plugin->packageValid(currentDep.pkg())) {
-				throw tr("The package name %1 is not valid for provider %{bld}%2%{end}")
-						.arg(currentDep.package, currentDep.provider);
+						foundDeps->append(cpDep);
+				});
 			}
-			installPackage(currentDep, plugin, true);
 		}
+		group.wait();
+		verifyDeps(*foundDeps, currentDep);
+		currentDep = foundDeps->takeFirst();
+	} else { // third: provider provider set, version may or may not be set
+		Q_ASSERT(!currentDep.provider.isEmpty());
+		auto plugin = registry()->sourcePlugin(currentDep.provider);
+		if(!plugin->packageValid(currentDep.pkg())) {
+			throw tr("The package name %1 is not valid for provider %{bld}%2%{end}")
+					.arg(currentDep.package, currentDep.provider);
+		}
+		installPackage(currentDep, plugin, true);
 	}
+}
 
-	if(_addPkgCount > 0)
-		completeInstall();
-	else
-		xDebug() << tr("Skipping add to qpmx.json, only cache installs");
-	xDebug() << tr("Package installation completed");
-	qApp->quit();
-	return;
+void InstallCommand::planPackage(const QpmxDevDependency &dep)
+{
+	_pkgPlan.insert(dep, dep.version);
+}
+
+void InstallCommand::updatePackage(int index, const QpmxDevDependency &dep)
+{
+	//the plan is keyed by provider and package, so a resolved provider needs a new entry as well
+	auto &current = _pkgList[index];
+	if(current.provider != dep.provider ||
+	   current.package != dep.package ||
+	   current.version != dep.version) {
+		_pkgPlan.remove(current, current.version);
+		planPackage(dep);
+	}
+	current = dep;
+}
+
+void InstallCommand::prefetch(int begin, int end)
+{
+	//resolve missing versions with one batched lookup per provider
+	QMap<QString, QList<int>> versionLookups;
+	for(auto i = begin; i < end; ++i) {
+		const auto &dep = _pkgList[i];
+		if(!dep.provider.isEmpty() &&
+		   dep.version.isNull() &&
+		   registry()->sourcePlugin(dep.provider)->packageValid(dep.pkg()))
+			versionLookups[dep.provider].append(i);
+	}
+
+	TaskGroup versionGroup{this};
+	for(auto it = versionLookups.constBegin(); it != versionLookups.constEnd(); it++) {
+		if(it->size() < 2)
+			continue;
+		auto plugin = registry()->sourcePlugin(it.key());
+		auto indexes = it.value();
+		versionGroup.run(it.key(), [this, plugin, indexes](){
+			QList<PackageInfo> packages;
+			packages.reserve(indexes.size());
+			for(auto index : indexes)
+				packages.append(_pkgList[index].pkg());
+			xDebug() << tr("Searching for latest versions of %n package(s) at once", "", packages.size());
+			auto versions = plugin->findPackageVersions(packages);
+			for(auto i = 0; i < indexes.size() && i < versions.size(); i++) {
+				if(!versions[i].isNull()) {
+					auto dep = _pkgList[indexes[i]];
+					dep.version = versions[i];
+					updatePackage(indexes[i], dep);
+				}
+			}
+		});
+	}
+	versionGroup.wait();
+
+	//download missing sources with one batched fetch per provider
+	if(_renew)
+		return;
+	QMap<QString, QList<QpmxDevDependency>> downloads;
+	for(auto i = begin; i < end; ++i) {
+		const auto &dep = _pkgList[i];
+		if(dep.isComplete() && !dep.isDev() && !srcDir(dep).exists())
+			downloads[dep.provider].append(dep);
+	}
+
+	TaskGroup sourceGroup{this};
+	for(auto it = downloads.constBegin(); it != downloads.constEnd(); it++) {
+		if(it->size() < 2)
+			continue;
+		auto plugin = registry()->sourcePlugin(it.key());
+		auto deps = it.value();
+		sourceGroup.run(it.key(), [this, plugin, deps](){
+			prefetchSources(plugin, deps);
+		});
+	}
+	sourceGroup.wait();
+}
+
+void InstallCommand::prefetchSources(SourcePlugin *plugin, QList<QpmxDevDependency> deps)
+{
+	//lock in a fixed order, to not deadlock with other qpmx instances
+	std::sort(deps.begin(), deps.end(), [](const QpmxDevDependency &lhs, const QpmxDevDependency &rhs){
+		return lhs.toString() < rhs.toString();
+	});
+
+	std::vector<CacheLock> locks;
+	QList<QSharedPointer<QTemporaryDir>> tmpDirs;
+	QList<QpmxDevDependency> fetched;
+	QList<QPair<PackageInfo, QDir>> batch;
+	for(const auto &dep : qAsConst(deps)) {
+		auto lock = pkgLock(dep);
+		if(srcDir(dep).exists())
+			continue;
+
+		auto tDir = QSharedPointer<QTemporaryDir>::create(tmpDir().absoluteFilePath(QStringLiteral("src.XXXXXX")));
+		if(!tDir->isValid())
+			throw tr("Failed to create temporary directory with error: %1").arg(tDir->errorString());
+		locks.push_back(std::move(lock));
+		tmpDirs.append(tDir);
+		fetched.append(dep);
+		batch.append({dep.pkg(), QDir{tDir->path()}});
+	}
+	if(batch.isEmpty())
+		return;
+
+	xDebug() << tr("Gettings sources for %n package(s) at once", "", batch.size());
+	plugin->getPackageSources(batch);
+
+	//move all complete downloads to the cache, failed ones are retried one by one
+	for(auto i = 0; i < fetched.size(); i++) {
+		const auto &current = fetched[i];
+		QFileInfo path = tmpDirs[i]->path();
+		if(!QDir{path.absoluteFilePath()}.exists(QStringLiteral("qpmx.json"))) {
+			xDebug() << tr("Batched download of %1 did not succeed").arg(current.toString());
+			continue;
+		}
+
+		tmpDirs[i]->setAutoRemove(false);
+		auto oDir = srcDir(current.provider, current.package, {}, true);
+		auto vSubDir = oDir.absoluteFilePath(current.version.toString());
+		if(!path.dir().rename(path.fileName(), vSubDir))
+			throw tr("Failed to move downloaded sources of %1 from temporary directory to cache directory!").arg(current.toString());
+		QpmxFormat::writeBinary(vSubDir, QpmxFormat::readFile(vSubDir, true));
+		xInfo() << tr("Installed package %1").arg(current.toString());
+	}
 }
 
 void InstallCommand::completeInstall()
@@ -153,8 +320,11 @@ void InstallCommand::completeInstall()
 	}
 
 	auto format = QpmxFormat::readDefault();
+	QList<QpmxDependency> newDeps;
+	newDeps.reserve(_addPkgCount);
 	for(const auto &pkg : _pkgList.mid(0, _addPkgCount))
-		format.putDependency(pkg);
+		newDeps.append(pkg);
+	format.putDependencies(newDeps);
 	QpmxFormat::writeDefault(format);
 	xInfo() << "Added all packages to qpmx.json";
 
@@ -201,7 +371,11 @@ bool InstallCommand::installPackage(QpmxDevDependency &current, SourcePlugin *pl
 		return false;
 
 	Q_ASSERT(lock.isLocked());
-	auto format = QpmxFormat::readFile(srcDir(current), true);
+	auto sDir = srcDir(current);
+	auto format = QpmxFormat::readFile(sDir, true);
+	//cached manifests are immutable -> keep a pre-parsed copy next to them
+	if(!current.isDev() && !sDir.exists(QStringLiteral(".qpmx.json.bin")))
+		QpmxFormat::writeBinary(sDir, format);
 	//create the src_include in the build dir
 	createSrcInclude(current, format, lock);
 	//add new dependencies
@@ -254,6 +428,7 @@ bool InstallCommand::getSource(QpmxDevDependency &current, SourcePlugin *plugin,
 		auto vSubDir = oDir.absoluteFilePath(current.version.toString());
 		if(!path.dir().rename(path.fileName(), vSubDir))
 			throw tr("Failed to move downloaded sources of %1 from temporary directory to cache directory!").arg(current.toString());
+		QpmxFormat::writeBinary(vSubDir, format);
 		xDebug() << tr("Moved sources to cache directory");
 		xInfo() << tr("Installed package %1").arg(current.toString());
 		return true;
@@ -273,15 +448,14 @@ void InstallCommand::createSrcInclude(const QpmxDevDependency &current, const Qp
 	auto sDir = srcDir(current);
 	auto bDir = buildDir(QStringLiteral("src"), current, true);
 
-	QFile srcPriFile{bDir.absoluteFilePath(QStringLiteral("include.pri"))};
-	if(srcPriFile.exists()) {
+	auto srcPriPath = bDir.absoluteFilePath(QStringLiteral("include.pri"));
+	if(QFile::exists(srcPriPath)) {
 		qDebug() << "source include.pri already exists. Skipping generation";
 		return;
 	}
 
-	if(!srcPriFile.open(QIODevice::WriteOnly | QIODevice::Text))
-		throw tr("Failed to open src_include.pri with error: %1").arg(srcPriFile.errorString());
-	QTextStream stream{&srcPriFile};
+	QByteArray priData;
+	QTextStream stream{&priData};
 	stream << "!contains(QPMX_INCLUDE_GUARDS, \"" << current.package << "\") {\n\n"
 		   << "\tQPMX_INCLUDE_GUARDS += \"" << current.package << "\"\n"
 		   << "\t#dependencies\n";
@@ -299,7 +473,8 @@ void InstallCommand::createSrcInclude(const QpmxDevDependency &current, const Qp
 		   << "\tinclude(" << srcIncPri << ")\n"
 		   << "}\n";
 	stream.flush();
-	srcPriFile.close();
+	writeIfChanged(srcPriPath, priData);
+	writeArtifactKey(bDir);
 	xInfo() << tr("Generated source include.pri");
 }
 
@@ -323,18 +498,13 @@ void InstallCommand::detectDeps(const QpmxFormat &format)
 		// replace aliases
 		replaceAlias(dep, _aliases);
 		// check if needed
-		auto dIndex = -1;
-		do {
-			dIndex = _pkgList.indexOf(dep, dIndex + 1);
-			if(dIndex != -1 && _pkgList[dIndex].version == dep.version) { //fine here, as dependencies do not trigger "duplicate" warnings
-				xDebug() << tr("Skipping dependency %1 as it is already in the install list").arg(dep.toString());
-				break;
-			}
-		} while(dIndex != -1);
-
-		if(dIndex == -1) {
-			xDebug() << tr("Detected dependency to install: %1").arg(dep.toString());
-			_pkgList.append(dep);
+		if(_pkgPlan.contains(dep, dep.version)) { //fine here, as dependencies do not trigger "duplicate" warnings
+			xDebug() << tr("Skipping dependency %1 as it is already in the install list").arg(dep.toString());
+			continue;
 		}
+
+		xDebug() << tr("Detected dependency to install: %1").arg(dep.toString());
+		_pkgList.append(dep);
+		planPackage(dep);
 	}
 }
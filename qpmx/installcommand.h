@@ -16,6 +16,8 @@ public:
 	QString commandDescription() const override;
 	QSharedPointer<QCliNode> createCliNode() const override;
 
+	void installProject(bool renew);
+
 protected slots:
 	void initialize(QCliParser &parser) override;
 
@@ -24,10 +26,17 @@ private:
 	bool _noPrepare = false;
 
 	QList<QpmxDevDependency> _pkgList;
-	QList<QpmxDevAlias> _aliases;
+	QMultiHash<QpmxDependency, QVersionNumber> _pkgPlan;
+	AliasMap _aliases;
 	int _addPkgCount = 0;
 
+	bool loadProject();
 	void getPackages();
+	void planPackage(const QpmxDevDependency &dep);
+	void updatePackage(int index, const QpmxDevDependency &dep);
+	void getPackage(QpmxDevDependency &currentDep);
+	void prefetch(int begin, int end);
+	void prefetchSources(qpmx::SourcePlugin *plugin, QList<QpmxDevDependency> deps);
 	void completeInstall();
 
 	bool getVersion(QpmxDevDependency &current, qpmx::SourcePlugin *plugin, bool mustWork);
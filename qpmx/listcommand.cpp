@@ -44,7 +44,7 @@ void ListCommand::initialize(QCliParser &parser)
 			listKits(parser);
 		else
 			Q_UNREACHABLE();
-		qApp->quit();
+		quit();
 	} catch (QString &s) {
 		xCritical() << s;
 	}
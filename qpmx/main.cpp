@@ -17,6 +17,8 @@
 #include "translatecommand.h"
 #include "hookcommand.h"
 #include "qbscommand.h"
+#include "daemoncommand.h"
+#include "messagehandler.h"
 
 #include <QCoreApplication>
 #include <QException>
@@ -26,19 +28,15 @@
 #include <QCtrlSignals>
 
 #include <QStandardPaths>
-#include <iostream>
 
 #include <qtcoroutine.h>
 
 #include "bridge.h"
 using namespace qpmx;
 
-static bool colored = false;
-static QSet<QtMsgType> logLevel{QtCriticalMsg, QtFatalMsg};
-
+static QHash<QString, Command*> createCommands(QObject *parent);
 template <typename T>
-static void addCommand(QHash<QString, Command*> &commands);
-static void qpmxMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg);
+static void addCommand(QHash<QString, Command*> &commands, QObject *parent);
 
 int main(int argc, char *argv[])
 {
@@ -53,63 +51,17 @@ int main(int argc, char *argv[])
 	QJsonSerializer::registerAllConverters<QpmxDevAlias>();
 	qRegisterMetaTypeStreamOperators<QVersionNumber>();
 
-	QHash<QString, Command*> commands;
-	addCommand<ListCommand>(commands);
-	addCommand<SearchCommand>(commands);
-	addCommand<InstallCommand>(commands);
-	addCommand<UninstallCommand>(commands);
-	addCommand<UpdateCommand>(commands);
-	addCommand<CompileCommand>(commands);
-	addCommand<GenerateCommand>(commands);
-	addCommand<CreateCommand>(commands);
-	addCommand<PrepareCommand>(commands);
-	addCommand<PublishCommand>(commands);
-	addCommand<DevCommand>(commands);
-	addCommand<InitCommand>(commands);
-	addCommand<ClearCachesCommand>(commands);
-	addCommand<TranslateCommand>(commands);
-	addCommand<HookCommand>(commands);
-	addCommand<QbsCommand>(commands);
+	auto startDir = QDir::currentPath();
+	auto commands = createCommands(qApp);
+	DaemonCommand::setCommandFactory(createCommands);
 
 	QCliParser parser;
 	Command::setupParser(parser, commands);
 	parser.process(a, true);
 
 	//setup logging
-	QString prefix;
-	if(parser.isSet(QStringLiteral("qmake-run")))
-		prefix = QStringLiteral("qpmx.json:1: ");
-#ifndef Q_OS_WIN
-	colored = !parser.isSet(QStringLiteral("no-color"));
-	if(colored) {
-		qSetMessagePattern(QCoreApplication::translate("parser", "%{if-warning}\033[33m%1Warning: %{endif}"
-																 "%{if-critical}\033[31m%1Error: %{endif}"
-																 "%{if-fatal}\033[35m%1Fatal Error: %{endif}"
-																 "%{if-category}%{category}: %{endif}%{message}"
-																 "%{if-warning}\033[0m%{endif}"
-																 "%{if-critical}\033[0m%{endif}"
-																 "%{if-fatal}\033[0m%{endif}")
-						   .arg(prefix));
-	} else
-#endif
-	{
-		qSetMessagePattern(QCoreApplication::translate("parser", "%{if-warning}%1Warning: %{endif}"
-																 "%{if-critical}%1Error: %{endif}"
-																 "%{if-fatal}%1Fatal Error: %{endif}"
-																 "%{if-category}%{category}: %{endif}%{message}")
-						   .arg(prefix));
-	}
-
-	if(!parser.isSet(QStringLiteral("quiet"))) {
-		logLevel.insert(QtWarningMsg);
-		logLevel.insert(QtInfoMsg);
-		if(parser.isSet(QStringLiteral("verbose")))
-			logLevel.insert(QtDebugMsg);
-	} else {
-		if(parser.isSet(QStringLiteral("verbose")))
-			logLevel.insert(QtWarningMsg);
-	}
-	qInstallMessageHandler(qpmxMessageHandler);
+	MessageHandler::setup(parser);
+	MessageHandler::install();
 
 	//perform cd
 	if(parser.isSet(QStringLiteral("dir"))){
@@ -132,6 +84,14 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	//let a running daemon execute the command
+	if(DaemonCommand::canForward(cmd->commandName())) {
+		auto daemon = static_cast<DaemonCommand*>(commands.value(QStringLiteral("daemon")));
+		auto exitCode = EXIT_FAILURE;
+		if(daemon->forward(a.arguments().mid(1), startDir, exitCode))
+			return exitCode;
+	}
+
 	QObject::connect(qApp, &QCoreApplication::aboutToQuit,
 					 cmd, &Command::fin);
 	QCtrlSignalHandler::instance()->setAutoQuitActive(true);
@@ -145,51 +105,32 @@ int main(int argc, char *argv[])
 	return a.exec();
 }
 
-template <typename T>
-static void addCommand(QHash<QString, Command*> &commands)
+static QHash<QString, Command*> createCommands(QObject *parent)
 {
-	auto cmd = new T(qApp);
-	commands.insert(cmd->commandName(), cmd);
+	QHash<QString, Command*> commands;
+	addCommand<ListCommand>(commands, parent);
+	addCommand<SearchCommand>(commands, parent);
+	addCommand<InstallCommand>(commands, parent);
+	addCommand<UninstallCommand>(commands, parent);
+	addCommand<UpdateCommand>(commands, parent);
+	addCommand<CompileCommand>(commands, parent);
+	addCommand<GenerateCommand>(commands, parent);
+	addCommand<CreateCommand>(commands, parent);
+	addCommand<PrepareCommand>(commands, parent);
+	addCommand<PublishCommand>(commands, parent);
+	addCommand<DevCommand>(commands, parent);
+	addCommand<InitCommand>(commands, parent);
+	addCommand<ClearCachesCommand>(commands, parent);
+	addCommand<TranslateCommand>(commands, parent);
+	addCommand<HookCommand>(commands, parent);
+	addCommand<QbsCommand>(commands, parent);
+	addCommand<DaemonCommand>(commands, parent);
+	return commands;
 }
 
-static void qpmxMessageHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+template <typename T>
+static void addCommand(QHash<QString, Command*> &commands, QObject *parent)
 {
-	if(!logLevel.contains(type))
-		return;
-
-	auto message = qFormatLogMessage(type, context, msg);
-	if(colored) {
-		message.replace(QStringLiteral("%{pkg}"), QStringLiteral("\033[36m"));
-		message.replace(QStringLiteral("%{bld}"), QStringLiteral("\033[32m"));
-		switch (type) {
-		case QtDebugMsg:
-		case QtInfoMsg:
-			message.replace(QStringLiteral("%{end}"), QStringLiteral("\033[0m"));
-			break;
-		case QtWarningMsg:
-			message.replace(QStringLiteral("%{end}"), QStringLiteral("\033[33m"));
-			break;
-		case QtCriticalMsg:
-			message.replace(QStringLiteral("%{end}"), QStringLiteral("\033[31m"));
-			break;
-		case QtFatalMsg:
-			message.replace(QStringLiteral("%{end}"), QStringLiteral("\033[35m"));
-			break;
-		default:
-			Q_UNREACHABLE();
-			break;
-		}
-	} else {
-		message.replace(QStringLiteral("%{pkg}"), QStringLiteral("\""));
-		message.replace(QStringLiteral("%{bld}"), QStringLiteral("\""));
-		message.replace(QStringLiteral("%{end}"), QStringLiteral("\""));
-	}
-
-	if(type == QtDebugMsg || type == QtInfoMsg)
-		std::cout << message.toStdString() << std::endl;
-	else
-		std::cerr << message.toStdString() << std::endl;
-
-	if(type == QtCriticalMsg)
-		qApp->exit(Command::exitCode());
+	auto cmd = new T(parent);
+	commands.insert(cmd->commandName(), cmd);
 }
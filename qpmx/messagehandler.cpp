@@ -0,0 +1,109 @@
+#include "messagehandler.h"
+#include "command.h"
+
+#include <QCoreApplication>
+#include <iostream>
+
+bool MessageHandler::_colored = false;
+QSet<QtMsgType> MessageHandler::_logLevel;
+MessageHandler::Sink MessageHandler::_sink;
+
+void MessageHandler::setup(QCliParser &parser)
+{
+	QString prefix;
+	if(parser.isSet(QStringLiteral("qmake-run")))
+		prefix = QStringLiteral("qpmx.json:1: ");
+#ifndef Q_OS_WIN
+	_colored = !parser.isSet(QStringLiteral("no-color"));
+	if(_colored) {
+		qSetMessagePattern(QCoreApplication::translate("parser", "%{if-warning}\033[33m%1Warning: %{endif}"
+																 "%{if-critical}\033[31m%1Error: %{endif}"
+																 "%{if-fatal}\033[35m%1Fatal Error: %{endif}"
+																 "%{if-category}%{category}: %{endif}%{message}"
+																 "%{if-warning}\033[0m%{endif}"
+																 "%{if-critical}\033[0m%{endif}"
+																 "%{if-fatal}\033[0m%{endif}")
+						   .arg(prefix));
+	} else
+#endif
+	{
+		qSetMessagePattern(QCoreApplication::translate("parser", "%{if-warning}%1Warning: %{endif}"
+																 "%{if-critical}%1Error: %{endif}"
+																 "%{if-fatal}%1Fatal Error: %{endif}"
+																 "%{if-category}%{category}: %{endif}%{message}")
+						   .arg(prefix));
+	}
+
+	_logLevel = {QtCriticalMsg, QtFatalMsg};
+	if(!parser.isSet(QStringLiteral("quiet"))) {
+		_logLevel.insert(QtWarningMsg);
+		_logLevel.insert(QtInfoMsg);
+		if(parser.isSet(QStringLiteral("verbose")))
+			_logLevel.insert(QtDebugMsg);
+	} else {
+		if(parser.isSet(QStringLiteral("verbose")))
+			_logLevel.insert(QtWarningMsg);
+	}
+}
+
+void MessageHandler::install()
+{
+	qInstallMessageHandler(handleMessage);
+}
+
+void MessageHandler::setSink(const Sink &sink)
+{
+	_sink = sink;
+}
+
+void MessageHandler::handleMessage(QtMsgType type, const QMessageLogContext &context, const QString &msg)
+{
+	if(!_logLevel.contains(type))
+		return;
+
+	auto message = qFormatLogMessage(type, context, msg);
+	if(_colored) {
+		message.replace(QStringLiteral("%{pkg}"), QStringLiteral("\033[36m"));
+		message.replace(QStringLiteral("%{bld}"), QStringLiteral("\033[32m"));
+		switch (type) {
+		case QtDebugMsg:
+		case QtInfoMsg:
+			message.replace(QStringLiteral("%{end}"), QStringLiteral("\033[0m"));
+			break;
+		case QtWarningMsg:
+			message.replace(QStringLiteral("%{end}"), QStringLiteral("\033[33m"));
+			break;
+		case QtCriticalMsg:
+			message.replace(QStringLiteral("%{end}"), QStringLiteral("\033[31m"));
+			break;
+		case QtFatalMsg:
+			message.replace(QStringLiteral("%{end}"), QStringLiteral("\033[35m"));
+			break;
+		default:
+			Q_UNREACHABLE();
+			break;
+		}
+	} else {
+		message.replace(QStringLiteral("%{pkg}"), QStringLiteral("\""));
+		message.replace(QStringLiteral("%{bld}"), QStringLiteral("\""));
+		message.replace(QStringLiteral("%{end}"), QStringLiteral("\""));
+	}
+
+	//commands served by the daemon report to their client and must not stop the daemon
+	if(_sink) {
+		_sink(type, message);
+		if(type == QtCriticalMsg)
+			Command::markFailed();
+		return;
+	}
+
+	if(type == QtDebugMsg || type == QtInfoMsg)
+		std::cout << message.toStdString() << std::endl;
+	else
+		std::cerr << message.toStdString() << std::endl;
+
+	if(type == QtCriticalMsg) {
+		Command::markFailed();
+		qApp->exit(Command::exitCode());
+	}
+}
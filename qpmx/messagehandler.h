@@ -0,0 +1,26 @@
+#ifndef MESSAGEHANDLER_H
+#define MESSAGEHANDLER_H
+
+#include <QSet>
+#include <QString>
+#include <functional>
+#include <qcliparser.h>
+
+class MessageHandler
+{
+public:
+	using Sink = std::function<void(QtMsgType, const QString &)>;
+
+	static void setup(QCliParser &parser);
+	static void install();
+	static void setSink(const Sink &sink);
+
+private:
+	static bool _colored;
+	static QSet<QtMsgType> _logLevel;
+	static Sink _sink;
+
+	static void handleMessage(QtMsgType type, const QMessageLogContext &context, const QString &msg);
+};
+
+#endif // MESSAGEHANDLER_H
@@ -10,9 +10,59 @@ using namespace qpmx;
 
 Q_GLOBAL_STATIC(PluginRegistry, registry)
 
+namespace {
+
+//plugins built against the 1.0 interface lack the batch virtuals - only call what their vtable has
+class LegacySourcePlugin : public SourcePlugin
+{
+public:
+	explicit LegacySourcePlugin(SourcePlugin *plugin) :
+		_plugin{plugin}
+	{}
+
+	bool canSearch(const QString &provider) const override {
+		return _plugin->canSearch(provider);
+	}
+	bool canPublish(const QString &provider) const override {
+		return _plugin->canPublish(provider);
+	}
+	QString packageSyntax(const QString &provider) const override {
+		return _plugin->packageSyntax(provider);
+	}
+	bool packageValid(const PackageInfo &package) const override {
+		return _plugin->packageValid(package);
+	}
+
+	QJsonObject createPublisherInfo(const QString &provider) override {
+		return _plugin->createPublisherInfo(provider);
+	}
+	QStringList searchPackage(const QString &provider, const QString &query) override {
+		return _plugin->searchPackage(provider, query);
+	}
+	QVersionNumber findPackageVersion(const PackageInfo &package) override {
+		return _plugin->findPackageVersion(package);
+	}
+	void getPackageSource(const PackageInfo &package, const QDir &targetDir) override {
+		_plugin->getPackageSource(package, targetDir);
+	}
+	void publishPackage(const QString &provider, const QDir &qpmxDir, const QVersionNumber &version, const QJsonObject &publisherInfo) override {
+		_plugin->publishPackage(provider, qpmxDir, version, publisherInfo);
+	}
+
+	void cancelAll(int timeout) override {
+		_plugin->cancelAll(timeout);
+	}
+
+private:
+	SourcePlugin *_plugin;
+};
+
+}
+
 PluginRegistry::PluginRegistry(QObject *parent) :
 	QObject{parent},
-	_factory{new QPluginFactory<SourcePlugin>{QStringLiteral("qpmx"), this}}
+	_factory{new QPluginFactory<SourcePlugin>{QStringLiteral("qpmx"), this}},
+	_legacyFactory{new QPluginFactoryBase{QStringLiteral("qpmx"), SourcePlugin_iid_1_0, this}}
 {}
 
 PluginRegistry *PluginRegistry::instance()
@@ -22,7 +72,12 @@ PluginRegistry *PluginRegistry::instance()
 
 QStringList PluginRegistry::providerNames()
 {
-	return _factory->allKeys();
+	auto keys = _factory->allKeys();
+	for(const auto &key : _legacyFactory->allKeys()) {
+		if(!keys.contains(key))
+			keys.append(key);
+	}
+	return keys;
 }
 
 SourcePlugin *PluginRegistry::sourcePlugin(const QString &provider)
@@ -33,8 +88,15 @@ SourcePlugin *PluginRegistry::sourcePlugin(const QString &provider)
 		   return srcPlg;
 
 		srcPlg = _factory->plugin(provider);
-		if(!srcPlg)
-			throw tr("No plugin found for provider: %{bld}%1%{end}").arg(provider);
+		if(!srcPlg) {
+			auto legacyObj = _legacyFactory->plugin(provider);
+			auto legacyPlg = legacyObj ? static_cast<SourcePlugin*>(legacyObj->qt_metacast(SourcePlugin_iid_1_0)) : nullptr;
+			if(!legacyPlg)
+				throw tr("No plugin found for provider: %{bld}%1%{end}").arg(provider);
+			xDebug() << tr("Loaded provider %1 from a plugin built for the 1.0 plugin interface").arg(provider);
+			srcPlg = new LegacySourcePlugin{legacyPlg};
+			_legacyAdapters.append(QSharedPointer<SourcePlugin>{srcPlg});
+		}
 		_loadCache.insert(provider, srcPlg);
 		return srcPlg;
 	} catch (QPluginLoadException &e) {
@@ -20,7 +20,9 @@ public:
 
 private:
 	QPluginFactory<qpmx::SourcePlugin> *_factory;
+	QPluginFactoryBase *_legacyFactory;
 	QHash<QString, qpmx::SourcePlugin*> _loadCache;
+	QList<QSharedPointer<qpmx::SourcePlugin>> _legacyAdapters;
 };
 
 #endif // PLUGINREGISTRY_H
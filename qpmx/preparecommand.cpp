@@ -37,7 +37,7 @@ void PrepareCommand::initialize(QCliParser &parser)
 		auto format = QpmxFormat::readDefault();
 		format.publishers.insert(provider, plugin->createPublisherInfo(provider));
 		QpmxFormat::writeDefault(format);
-		qApp->quit();
+		quit();
 	} catch(QString &s) {
 		xCritical() << s;
 	}
@@ -81,5 +81,5 @@ void PublishCommand::publishPackages(const QStringList &providers)
 	}
 
 	xDebug() << tr("Package publishing completed");
-	qApp->quit();
+	quit();
 }
@@ -114,7 +114,7 @@ void QbsCommand::initialize(QCliParser &parser)
 			qbsLoad();
 		else
 			Q_UNREACHABLE();
-		qApp->quit();
+		quit();
 	} catch (QString &s) {
 		xCritical() << s;
 	}
@@ -364,20 +364,20 @@ void QbsCommand::createQpmxQbs(const QDir &modRoot)
 	auto content = inFile.readAll();
 	inFile.close();
 	content.replace("%{version}", appVer.toString().toUtf8());
+	writeIfChanged(outFile.fileName(), content);
 
-	if(!outFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-		throw tr("Failed to open %1 with error: %2")
-				.arg(outFile.fileName(), outFile.errorString());
-	}
-	outFile.write(content);
-	outFile.close();
-	if(!QFile::copy(QStringLiteral(":/build/qbs/qpmx.js"),
-					modDir.absoluteFilePath(QStringLiteral("qpmx.js"))))
-		throw tr("Failed to copy module script to module dir");
-	if(!modRoot.mkpath(QStringLiteral("../imports")) ||
-	   !QFile::copy(QStringLiteral(":/build/qbs/MergedStaticLibrary.qbs"),
-					modRoot.absoluteFilePath(QStringLiteral("../imports/MergedStaticLibrary.qbs"))))
+	auto copyScript = [this](const QString &source, const QString &target) {
+		QFile scriptFile{source};
+		if(!scriptFile.open(QIODevice::ReadOnly | QIODevice::Text))
+			throw tr("Failed to copy module script to module dir");
+		writeIfChanged(target, scriptFile.readAll());
+	};
+	copyScript(QStringLiteral(":/build/qbs/qpmx.js"),
+			   modDir.absoluteFilePath(QStringLiteral("qpmx.js")));
+	if(!modRoot.mkpath(QStringLiteral("../imports")))
 		throw tr("Failed to copy module script to module dir");
+	copyScript(QStringLiteral(":/build/qbs/MergedStaticLibrary.qbs"),
+			   modRoot.absoluteFilePath(QStringLiteral("../imports/MergedStaticLibrary.qbs")));
 	xDebug() << tr("Created qpmx qbs module");
 }
 
@@ -398,12 +398,8 @@ void QbsCommand::createQpmxGlobalQbs(const QDir &modRoot, const BuildId &kitId)
 		return;
 	}
 
-	QFile outFile(modDir.absoluteFilePath(QStringLiteral("module.qbs")));
-	if(!outFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-		throw tr("Failed to open %1 with error: %2")
-				.arg(outFile.fileName(), outFile.errorString());
-	}
-	QTextStream stream(&outFile);
+	QByteArray modData;
+	QTextStream stream(&modData);
 	stream << "import qbs\n\n"
 		   << "Module {\n"
 		   << "\tversion: \"" << QCoreApplication::applicationVersion() << "\"\n"
@@ -414,7 +410,7 @@ void QbsCommand::createQpmxGlobalQbs(const QDir &modRoot, const BuildId &kitId)
 		   << "\tproperty pathList libdeps: []\n"
 		   << "}\n";
 	stream.flush();
-	outFile.close();
+	writeIfChanged(modDir.absoluteFilePath(QStringLiteral("module.qbs")), modData);
 
 	QFile kitFile(modDir.absoluteFilePath(kitId));
 	if(!kitFile.open(QIODevice::WriteOnly)) {
@@ -439,20 +435,16 @@ void QbsCommand::createNextMod(const QDir &modRoot, const BuildId &kitId)
 		return;
 	}
 
-	// load src qpmx.json and build pri
+	// load src qpmx.json and build pri - sources can be removed by clear-caches or uninstall
+	auto _rl = pkgReadLock(dep.pkg());
 	auto srcFmDir = srcDir(dep);
 	auto srcFormat = QpmxFormat::readFile(srcFmDir, true);
 	QStringList hooks, qrcs;
 	std::tie(hooks, qrcs) = extractHooks(buildDir(kitId, dep));
 
 	// generate the qbs file
-	modDir.mkdir(QStringLiteral("basemod"));
-	QFile qbsMod(modDir.absoluteFilePath(QStringLiteral("basemod/QpmxModule.qbs")));
-	if(!qbsMod.open(QIODevice::WriteOnly | QIODevice::Text)) {
-		throw tr("Failed to open %1 with error: %2")
-				.arg(qbsMod.fileName(), qbsMod.errorString());
-	}
-	QTextStream stream(&qbsMod);
+	QByteArray modData;
+	QTextStream stream(&modData);
 	stream << "import qbs\n"
 		   << "import qbs.File\n"
 		   << "import qbs.FileInfo\n\n"
@@ -515,17 +507,17 @@ void QbsCommand::createNextMod(const QDir &modRoot, const BuildId &kitId)
 
 	stream << "}";
 	stream.flush();
-	qbsMod.close();
 
-	//check if prc is given
+	//check if prc is given - the generated module becomes its base module then
 	if(!srcFormat.qbsFile.isEmpty()) {
-		if(!QFile::copy(srcFmDir.absoluteFilePath(srcFormat.qbsFile),
-					modDir.absoluteFilePath(QStringLiteral("module.qbs"))))
+		modDir.mkdir(QStringLiteral("basemod"));
+		writeIfChanged(modDir.absoluteFilePath(QStringLiteral("basemod/QpmxModule.qbs")), modData);
+		QFile qbsFile{srcFmDir.absoluteFilePath(srcFormat.qbsFile)};
+		if(!qbsFile.open(QIODevice::ReadOnly | QIODevice::Text))
 			throw tr("Failed to copy qbs file to qbs module dir for package %1").arg(dep.toString());
-	} else {
-		if(!qbsMod.rename(modDir.absoluteFilePath(QStringLiteral("module.qbs"))))
-			throw tr("Failed to generate qbs file for package %1").arg(dep.toString());
-	}
+		writeIfChanged(modDir.absoluteFilePath(QStringLiteral("module.qbs")), qbsFile.readAll());
+	} else
+		writeIfChanged(modDir.absoluteFilePath(QStringLiteral("module.qbs")), modData);
 	xInfo() << tr("Created qbs module for package %1").arg(dep.toString());
 }
 
@@ -572,12 +564,23 @@ std::tuple<QStringList, QStringList> QbsCommand::extractHooks(const QDir &buildD
 		auto line = stream.readLine().trimmed().split(QStringLiteral("+="));
 		if(line.size() != 2)
 			continue;
-		else if(line[0].simplified() == QStringLiteral("QPMX_STARTUP_HOOKS"))
+		else if(line[0].simplified() == QStringLiteral("QPMX_STARTUP_HOOKS") ||
+				line[0].simplified() == QStringLiteral("QPMX_DEFERRED_HOOKS")) //qbs has no hook table, so deferred ones run eagerly
 			hooks.append(line[1].trimmed().mid(1, line[1].size() - 3).split(QStringLiteral("\" \"")));
-		else if(line[0].simplified() == QStringLiteral("QPMX_RESOURCE_FILES"))
+		else if(line[0].simplified() == QStringLiteral("QPMX_RESOURCE_FILES") ||
+				line[0].simplified() == QStringLiteral("QPMX_DEFERRED_RESOURCES"))
 			qrcs.append(line[1].trimmed().mid(1, line[1].size() - 3).split(QStringLiteral("\" \"")));
 	}
 
+	//external rcc files are only supported for qmake projects
+	for(auto it = qrcs.begin(); it != qrcs.end();) {
+		if(it->endsWith(QStringLiteral(".rcc"))) {
+			xWarning() << tr("External resource %1 is not supported by qbs and will not be registered").arg(*it);
+			it = qrcs.erase(it);
+		} else
+			it++;
+	}
+
 	incFile.close();
 	return std::make_tuple(hooks, qrcs);
 }
@@ -0,0 +1,177 @@
+#include "qmfile.h"
+#include <QtEndian>
+#include <algorithm>
+
+const QByteArray QmFile::Magic = QByteArray::fromHex("3cb86418caef9c95cd211cbf60a1bddd");
+
+namespace {
+
+quint32 read32(const QByteArray &data, int offset)
+{
+	if(offset < 0 || offset + 4 > data.size())
+		throw QmFile::tr("Unexpected end of qm data");
+	return qFromBigEndian<quint32>(reinterpret_cast<const uchar*>(data.constData() + offset));
+}
+
+void append32(QByteArray &data, quint32 value)
+{
+	uchar buffer[sizeof(quint32)];
+	qToBigEndian(value, buffer);
+	data.append(reinterpret_cast<const char*>(buffer), sizeof(quint32));
+}
+
+void appendBlock(QByteArray &data, quint8 tag, const QByteArray &block)
+{
+	data.append(static_cast<char>(tag));
+	append32(data, static_cast<quint32>(block.size()));
+	data.append(block);
+}
+
+}
+
+QmFile QmFile::parse(const QByteArray &data)
+{
+	if(!data.startsWith(Magic))
+		throw tr("Invalid qm file magic");
+
+	QByteArray hashes;
+	QByteArray messages;
+	QmFile file;
+	auto offset = Magic.size();
+	while(offset < data.size()) {
+		auto tag = static_cast<quint8>(data[offset]);
+		auto size = static_cast<int>(read32(data, offset + 1));
+		offset += 5;
+		if(size < 0 || offset + size > data.size())
+			throw tr("Unexpected end of qm data");
+		auto block = data.mid(offset, size);
+		offset += size;
+
+		switch(tag) {
+		case Hashes:
+			hashes = block;
+			break;
+		case Messages:
+			messages = block;
+			break;
+		case NumerusRules:
+			file._numerusRules = block;
+			break;
+		case Dependencies:
+			file._dependencies = block;
+			break;
+		case Language:
+			file._language = block;
+			break;
+		case Contexts: //optional lookup acceleration, not needed for a merged file
+			break;
+		default:
+			throw tr("Unsupported qm block with tag 0x%1").arg(static_cast<uint>(tag), 2, 16, QLatin1Char('0'));
+		}
+	}
+
+	//messages are only reachable via the hash table, which also keeps the hash of stripped messages
+	for(auto i = 0; i + 8 <= hashes.size(); i += 8)
+		file.addMessage(readMessage(messages, read32(hashes, i + 4), read32(hashes, i)));
+	return file;
+}
+
+void QmFile::merge(const QmFile &other)
+{
+	//same as lconvert: messages of later files replace equal ones
+	if(_language.isEmpty())
+		_language = other._language;
+	if(_numerusRules.isEmpty())
+		_numerusRules = other._numerusRules;
+	if(_dependencies.isEmpty())
+		_dependencies = other._dependencies;
+	for(const auto &message : other._messages)
+		addMessage(message);
+}
+
+QByteArray QmFile::save() const
+{
+	//lookups search the hash table binary, so it must be sorted by hash
+	QVector<int> order(_messages.size());
+	for(auto i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [this](int lhs, int rhs) {
+		return _messages[lhs].hash < _messages[rhs].hash;
+	});
+
+	QByteArray hashes;
+	QByteArray messages;
+	hashes.reserve(order.size() * 8);
+	for(auto index : order) {
+		const auto &message = _messages[index];
+		append32(hashes, message.hash);
+		append32(hashes, static_cast<quint32>(messages.size()));
+		messages.append(message.data);
+	}
+
+	auto data = Magic;
+	if(!_language.isEmpty())
+		appendBlock(data, Language, _language);
+	if(!_dependencies.isEmpty())
+		appendBlock(data, Dependencies, _dependencies);
+	if(!messages.isEmpty()) {
+		appendBlock(data, Hashes, hashes);
+		appendBlock(data, Messages, messages);
+	}
+	if(!_numerusRules.isEmpty())
+		appendBlock(data, NumerusRules, _numerusRules);
+	return data;
+}
+
+QmFile::Message QmFile::readMessage(const QByteArray &messages, quint32 offset, quint32 hash)
+{
+	Message message;
+	message.hash = hash;
+	append32(message.key, hash);
+
+	auto start = static_cast<int>(offset);
+	auto pos = start;
+	forever {
+		if(pos < 0 || pos >= messages.size())
+			throw tr("Unexpected end of qm data");
+		auto tag = static_cast<quint8>(messages[pos++]);
+		switch(tag) {
+		case End:
+			message.data = messages.mid(start, pos - start);
+			return message;
+		case Translation:
+		{
+			auto size = read32(messages, pos);
+			pos += 4;
+			if(size != 0xFFFFFFFF) //null translation
+				pos += static_cast<int>(size);
+			break;
+		}
+		case Obsolete1:
+			pos += 4;
+			break;
+		case SourceText:
+		case Context:
+		case Comment:
+		{
+			//identifies the message, together with the hash
+			auto size = static_cast<int>(read32(messages, pos));
+			message.key.append(messages.mid(pos - 1, size + 5));
+			pos += 4 + size;
+			break;
+		}
+		default:
+			throw tr("Unsupported qm message tag 0x%1").arg(static_cast<uint>(tag), 2, 16, QLatin1Char('0'));
+		}
+	}
+}
+
+void QmFile::addMessage(const Message &message)
+{
+	auto index = _index.value(message.key, -1);
+	if(index == -1) {
+		_index.insert(message.key, _messages.size());
+		_messages.append(message);
+	} else
+		_messages[index] = message;
+}
@@ -0,0 +1,56 @@
+#ifndef QMFILE_H
+#define QMFILE_H
+
+#include <QCoreApplication>
+#include <QByteArray>
+#include <QHash>
+#include <QVector>
+
+class QmFile
+{
+	Q_DECLARE_TR_FUNCTIONS(QmFile)
+
+public:
+	static QmFile parse(const QByteArray &data);
+
+	void merge(const QmFile &other);
+	QByteArray save() const;
+
+private:
+	enum Tag : quint8 {
+		Contexts = 0x2f,
+		Hashes = 0x42,
+		Messages = 0x69,
+		NumerusRules = 0x88,
+		Dependencies = 0x96,
+		Language = 0xa7
+	};
+
+	enum MessageTag : quint8 {
+		End = 1,
+		Translation = 3,
+		Obsolete1 = 5,
+		SourceText = 6,
+		Context = 7,
+		Comment = 8
+	};
+
+	struct Message {
+		quint32 hash;
+		QByteArray key;
+		QByteArray data;
+	};
+
+	static const QByteArray Magic;
+
+	QByteArray _language;
+	QByteArray _numerusRules;
+	QByteArray _dependencies;
+	QVector<Message> _messages;
+	QHash<QByteArray, int> _index;
+
+	static Message readMessage(const QByteArray &messages, quint32 offset, quint32 hash);
+	void addMessage(const Message &message);
+};
+
+#endif // QMFILE_H
@@ -1,6 +1,6 @@
 TEMPLATE = app
 
-QT += core jsonserializer
+QT += core network jsonserializer
 QT -= gui
 
 CONFIG += console
@@ -22,6 +22,7 @@ HEADERS += \
 	uninstallcommand.h \
 	initcommand.h \
 	translatecommand.h \
+	qmfile.h \
 	devcommand.h \
 	preparecommand.h \
 	publishcommand.h \
@@ -30,7 +31,10 @@ HEADERS += \
 	clearcachescommand.h \
 	updatecommand.h \
 	qbscommand.h \
-	bridge.h
+	bridge.h \
+	searchindex.h \
+	daemoncommand.h \
+	messagehandler.h
 
 SOURCES += main.cpp \
 	installcommand.cpp \
@@ -44,6 +48,7 @@ SOURCES += main.cpp \
 	uninstallcommand.cpp \
 	initcommand.cpp \
 	translatecommand.cpp \
+	qmfile.cpp \
 	devcommand.cpp \
 	preparecommand.cpp \
 	publishcommand.cpp \
@@ -52,7 +57,10 @@ SOURCES += main.cpp \
 	clearcachescommand.cpp \
 	updatecommand.cpp \
 	qbscommand.cpp \
-	bridge.cpp
+	bridge.cpp \
+	searchindex.cpp \
+	daemoncommand.cpp \
+	messagehandler.cpp
 
 RESOURCES += \
 	qpmx.qrc
@@ -15,6 +15,7 @@ PRE_TARGETDEPS += $$QPMX_LIB_DEPS #lib targetdeps, needed for private merge
 		win32:debug_and_release: QPMX_MERGE_TARGET = $(DESTDIR_TARGET)
 		else:debug_and_release: QPMX_MERGE_TARGET = $(DESTDIR)$(TARGET)
 		else: QPMX_MERGE_TARGET = $(TARGET)
+		qpmx_lib_merge.depends += $$QPMX_LIB_DEPS
 
 		mac|ios|win32:!mingw {
 			QPMX_RAW_TARGET = $${QPMX_MERGE_TARGET}.raw
@@ -23,12 +24,19 @@ PRE_TARGETDEPS += $$QPMX_LIB_DEPS #lib targetdeps, needed for private merge
 			mac|ios: qpmx_lib_merge.commands += libtool -static -o $$QPMX_MERGE_TARGET $$QPMX_LIB_DEPS $$escape_expand(\\n\\t)
 			win32: qpmx_lib_merge.commands += lib.exe /OUT:$$QPMX_MERGE_TARGET $$QPMX_LIB_DEPS $$escape_expand(\\n\\t)
 			qpmx_lib_merge.depends += "$$QPMX_MERGE_TARGET"
+		} else:qpmx_thin_merge {
+			#only references the members of the raw library and the packages instead of copying them
+			QPMX_RAW_TARGET = $${QPMX_MERGE_TARGET}.raw
+			qpmx_lib_merge.commands = $$QMAKE_MOVE $$QPMX_MERGE_TARGET $$QPMX_RAW_TARGET $$escape_expand(\\n\\t)
+			qpmx_lib_merge.commands += ar cqT $$QPMX_MERGE_TARGET $$QPMX_RAW_TARGET $$QPMX_LIB_DEPS $$escape_expand(\\n\\t)
+			qpmx_lib_merge.depends += "$$QPMX_MERGE_TARGET"
 		} else {
 			qpmx_lib_mri.target = $${QPMX_MERGE_TARGET}.mri
 			qpmx_lib_mri.commands = echo "OPEN $${QPMX_MERGE_TARGET}" > $${QPMX_MERGE_TARGET}.mri $$escape_expand(\\n\\t)
 			for(lib, QPMX_LIB_DEPS): qpmx_lib_mri.commands += echo "addlib $$lib" >> $${QPMX_MERGE_TARGET}.mri $$escape_expand(\\n\\t)
 			qpmx_lib_mri.commands += echo "save" >> $${QPMX_MERGE_TARGET}.mri $$escape_expand(\\n\\t)
 			qpmx_lib_mri.commands += echo "end" >> $${QPMX_MERGE_TARGET}.mri
+			qpmx_lib_mri.depends += $$PWD/qpmx_generated.pri
 			qpmx_lib_merge.commands += ar -M < "$${QPMX_MERGE_TARGET}.mri" $$escape_expand(\\n\\t)
 			qpmx_lib_merge.depends += "$${QPMX_MERGE_TARGET}" qpmx_lib_mri
 			QMAKE_EXTRA_TARGETS += qpmx_lib_mri
@@ -61,9 +69,10 @@ else: QPMX_SRC_SEPERATOR = %%
 qpmx_src_build:CONFIG(static, static|shared): warning(qpmx source builds cannot generate a static library, as startup hooks and resources will not be available. Please switch to a compiled qpmx build!)
 
 #qpmx startup hook
-!qpmx_src_build:!isEmpty(QPMX_STARTUP_HOOKS)|!isEmpty(QPMX_RESOURCE_FILES) {
+!qpmx_src_build:!isEmpty(QPMX_STARTUP_HOOKS)|!isEmpty(QPMX_RESOURCE_FILES)|!isEmpty(QPMX_DEFERRED_HOOKS)|!isEmpty(QPMX_DEFERRED_RESOURCES) {
+	qpmx_hook_table: QPMX_HOOK_EXTRA_OPTIONS += --table
 	qpmx_hook_target.target = "$$QPMX_WORKINGDIR/qpmx_startup_hooks.cpp"
-	qpmx_hook_target.commands = $$QPMX_BIN hook $$QPMX_HOOK_EXTRA_OPTIONS --out $$shell_quote($$QPMX_WORKINGDIR/qpmx_startup_hooks.cpp) $$QPMX_STARTUP_HOOKS $$QPMX_SRC_SEPERATOR $$QPMX_RESOURCE_FILES
+	qpmx_hook_target.commands = $$QPMX_BIN hook $$QPMX_HOOK_EXTRA_OPTIONS --out $$shell_quote($$QPMX_WORKINGDIR/qpmx_startup_hooks.cpp) $$QPMX_STARTUP_HOOKS $$QPMX_SRC_SEPERATOR $$QPMX_RESOURCE_FILES $$QPMX_SRC_SEPERATOR $$QPMX_DEFERRED_HOOKS $$QPMX_SRC_SEPERATOR $$QPMX_DEFERRED_RESOURCES
 	qpmx_hook_target.depends += $$PWD/qpmx_generated.pri
 	QMAKE_EXTRA_TARGETS += qpmx_hook_target
 	GENERATED_SOURCES += "$$QPMX_WORKINGDIR/qpmx_startup_hooks.cpp"
@@ -90,7 +99,7 @@ qpmx_translate.commands = $$QPMX_BIN translate $$QPMX_TRANSLATE_EXTRA_OPTIONS --
 qpmx_src_build: qpmx_translate.commands += --src $$QPMX_LRELEASE $$QPMX_SRC_SEPERATOR $$QPMX_TRANSLATIONS
 else: qpmx_translate.commands += --qmake $$shell_quote($$QMAKE_QMAKE) --lconvert $$QPMX_LCONVERT $$QPMX_LRELEASE $$QPMX_SRC_SEPERATOR $$QPMX_TS_DIRS
 qpmx_translate.output = $$QPMX_WORKINGDIR/${QMAKE_FILE_BASE}.qm
-qpmx_translate.clean += $$QPMX_WORKINGDIR/${QMAKE_FILE_BASE}.qm $$QPMX_WORKINGDIR/${QMAKE_FILE_BASE}.qm-base
+qpmx_translate.clean += $$QPMX_WORKINGDIR/${QMAKE_FILE_BASE}.qm $$QPMX_WORKINGDIR/${QMAKE_FILE_BASE}.qm-base $$QPMX_WORKINGDIR/${QMAKE_FILE_BASE}.qm-cache
 qpmx_translate.CONFIG += no_link
 QMAKE_EXTRA_COMPILERS += qpmx_translate
 
@@ -126,5 +135,9 @@ for(tsfile, EXTRA_TRANSLATIONS) {
 	qpmx_ts_target.files += "$$OUT_PWD/$$QPMX_WORKINGDIR/$$replace(tsBase, \.ts, .qm)"
 }
 
+qpmx_rcc_target.CONFIG += no_check_exist
+for(res, QPMX_RESOURCE_FILES): contains(res, .*\.rcc$): qpmx_rcc_target.files += $$res
+for(res, QPMX_DEFERRED_RESOURCES): contains(res, .*\.rcc$): qpmx_rcc_target.files += $$res
+
 QMAKE_DIR_REPLACE += QPMX_WORKINGDIR
 QMAKE_DIR_REPLACE_SANE += QPMX_WORKINGDIR
@@ -3,8 +3,116 @@
 #include <QJsonDocument>
 #include <QJsonSerializer>
 #include <QSaveFile>
+#include <QHash>
+#include <QSet>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QDataStream>
+#include <functional>
 using namespace qpmx;
 
+namespace {
+
+// parsed formats are cached per process, keyed by the canonical file path
+template <typename T>
+class FormatCache
+{
+public:
+	static T read(QFile &file, bool mustExist, const std::function<void(T&)> &verify, const std::function<bool(const QFileInfo&, T&)> &preload = {});
+	static void invalidate(const QString &path);
+
+private:
+	struct Entry {
+		qint64 modified;
+		qint64 size;
+		T format;
+	};
+
+	static QMutex _lock;
+	static QHash<QString, Entry> _cache;
+};
+
+template <typename T>
+QMutex FormatCache<T>::_lock;
+template <typename T>
+QHash<QString, typename FormatCache<T>::Entry> FormatCache<T>::_cache;
+
+QAtomicInt parseCount = 0;
+QAtomicInt binaryCount = 0;
+QAtomicInt hitCount = 0;
+
+const quint32 BinaryMagic = 0x51504d46;
+const quint16 BinaryVersion = 3;
+const QString BinaryName = QStringLiteral(".qpmx.json.bin");
+
+template <typename T>
+T FormatCache<T>::read(QFile &file, bool mustExist, const std::function<void(T&)> &verify, const std::function<bool(const QFileInfo&, T&)> &preload)
+{
+	QFileInfo info{file};
+	if(!info.exists()) {
+		if(mustExist)
+			throw T::tr("%1 does not exist").arg(file.fileName());
+		else
+			return {};
+	}
+
+	auto path = info.canonicalFilePath();
+	auto modified = info.lastModified().toMSecsSinceEpoch();
+	{
+		QMutexLocker _{&_lock};
+		auto it = _cache.constFind(path);
+		if(it != _cache.constEnd() &&
+		   it->modified == modified &&
+		   it->size == info.size()) {
+			hitCount.ref();
+			return it->format;
+		}
+	}
+
+	if(preload) {
+		T format;
+		if(preload(info, format)) {
+			binaryCount.ref();
+			QMutexLocker _{&_lock};
+			_cache.insert(path, {modified, info.size(), format});
+			return format;
+		}
+	}
+
+	if(!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		throw T::tr("Failed to open %1 with error: %2")
+				.arg(file.fileName(), file.errorString());
+	}
+
+	try {
+		QJsonSerializer ser;
+		auto format = ser.deserializeFrom<T>(&file);
+		verify(format);
+		parseCount.ref();
+
+		QMutexLocker _{&_lock};
+		_cache.insert(path, {modified, info.size(), format});
+		return format;
+	} catch(QJsonSerializerException &e) {
+		qDebug() << e.what();
+		throw T::tr("%1 contains invalid data").arg(file.fileName());
+	}
+}
+
+template <typename T>
+void FormatCache<T>::invalidate(const QString &path)
+{
+	auto cPath = QFileInfo{path}.canonicalFilePath();
+	if(cPath.isEmpty())
+		return;
+	QMutexLocker _{&_lock};
+	_cache.remove(cPath);
+}
+
+}
+
 QpmxDependency::QpmxDependency() = default;
 
 QpmxDependency::QpmxDependency(const PackageInfo &package) :
@@ -46,6 +154,12 @@ PackageInfo QpmxDependency::pkg(const QString &provider) const
 	return {provider.isEmpty() ? this->provider : provider, package, version};
 }
 
+uint qHash(const QpmxDependency &dep, uint seed)
+{
+	//only provider and package "identify" the dependency
+	return qHash(dep.provider, seed) ^ qHash(dep.package, seed);
+}
+
 
 
 bool QpmxFormatLicense::operator!=(const QpmxFormatLicense &other) const
@@ -66,25 +180,12 @@ QpmxFormat QpmxFormat::readFile(const QDir &dir, bool mustExist)
 QpmxFormat QpmxFormat::readFile(const QDir &dir, const QString &fileName, bool mustExist)
 {
 	QFile qpmxFile(dir.absoluteFilePath(fileName));
-	if(qpmxFile.exists()) {
-		if(!qpmxFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-			throw tr("Failed to open %1 with error: %2")
-					.arg(qpmxFile.fileName(), qpmxFile.errorString());
-		}
-
-		try {
-			QJsonSerializer ser;
-			auto format = ser.deserializeFrom<QpmxFormat>(&qpmxFile);
-			format.checkDuplicates();
-			return format;
-		} catch(QJsonSerializerException &e) {
-			qDebug() << e.what();
-			throw tr("%1 contains invalid data").arg(qpmxFile.fileName());
-		}
-	} else if(mustExist)
-		throw tr("%1 does not exist").arg(qpmxFile.fileName());
-	else
-		return {};
+	return FormatCache<QpmxFormat>::read(qpmxFile, mustExist, [](QpmxFormat &format) {
+		format.checkDuplicates();
+	}, [](const QFileInfo &info, QpmxFormat &format) {
+		return info.fileName() == QStringLiteral("qpmx.json") &&
+				readBinary(info, format);
+	});
 }
 
 QpmxFormat QpmxFormat::readDefault(bool mustExist)
@@ -94,6 +195,7 @@ QpmxFormat QpmxFormat::readDefault(bool mustExist)
 
 void QpmxFormat::writeDefault(const QpmxFormat &data)
 {
+	FormatCache<QpmxFormat>::invalidate(QStringLiteral("./qpmx.json"));
 	QSaveFile qpmxFile(QStringLiteral("./qpmx.json"));
 	if(!qpmxFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
 		throw tr("Failed to open %1 with error: %2")
@@ -114,6 +216,111 @@ void QpmxFormat::writeDefault(const QpmxFormat &data)
 	}
 }
 
+QpmxFormat::ReadStats QpmxFormat::readStats()
+{
+	return {parseCount.load(), binaryCount.load(), hitCount.load()};
+}
+
+void QpmxFormat::resetStats()
+{
+	parseCount.store(0);
+	binaryCount.store(0);
+	hitCount.store(0);
+}
+
+void QpmxFormat::writeBinary(const QDir &dir, const QpmxFormat &data)
+{
+	QFileInfo srcInfo{dir.absoluteFilePath(QStringLiteral("qpmx.json"))};
+	QSaveFile binFile{dir.absoluteFilePath(BinaryName)};
+	if(!binFile.open(QIODevice::WriteOnly)) {
+		qWarning().noquote() << tr("Failed to open %1 with error: %2")
+								.arg(binFile.fileName(), binFile.errorString());
+		return;
+	}
+
+	QJsonObject publishers;
+	for(auto it = data.publishers.constBegin(); it != data.publishers.constEnd(); it++)
+		publishers.insert(it.key(), it.value());
+
+	QDataStream stream{&binFile};
+	stream << BinaryMagic << BinaryVersion;
+	stream.setVersion(QDataStream::Qt_5_6);
+	stream << srcInfo.lastModified().toMSecsSinceEpoch()
+		   << srcInfo.size()
+		   << data.priFile
+		   << data.prcFile
+		   << data.qbsFile
+		   << data.source
+		   << static_cast<quint32>(data.dependencies.size());
+	for(const auto &dep : data.dependencies)
+		stream << dep.provider << dep.package << dep.version;
+	stream << data.priIncludes
+		   << data.license.name
+		   << data.license.file
+		   << QJsonDocument{publishers}.toJson(QJsonDocument::Compact)
+		   << data.deferredHooks
+		   << data.deferredResources
+		   << data.externalResources;
+
+	if(!binFile.commit()) {
+		qWarning().noquote() << tr("Failed to save %1 with error: %2")
+								.arg(binFile.fileName(), binFile.errorString());
+	}
+}
+
+bool QpmxFormat::readBinary(const QFileInfo &srcInfo, QpmxFormat &data)
+{
+	QFile binFile{srcInfo.dir().absoluteFilePath(BinaryName)};
+	if(!binFile.exists() || !binFile.open(QIODevice::ReadOnly))
+		return false;
+
+	QDataStream stream{&binFile};
+	quint32 magic;
+	quint16 version;
+	stream >> magic >> version;
+	if(magic != BinaryMagic || version != BinaryVersion)
+		return false;
+	stream.setVersion(QDataStream::Qt_5_6);
+
+	//the sidecar is only valid for the exact qpmx.json it was created from
+	qint64 modified;
+	qint64 size;
+	stream >> modified >> size;
+	if(modified != srcInfo.lastModified().toMSecsSinceEpoch() ||
+	   size != srcInfo.size())
+		return false;
+
+	QpmxFormat format;
+	quint32 depCount;
+	stream >> format.priFile
+		   >> format.prcFile
+		   >> format.qbsFile
+		   >> format.source
+		   >> depCount;
+	for(quint32 i = 0; i < depCount && stream.status() == QDataStream::Ok; i++) {
+		QpmxDependency dep;
+		stream >> dep.provider >> dep.package >> dep.version;
+		format.dependencies.append(dep);
+	}
+	QByteArray publishers;
+	stream >> format.priIncludes
+		   >> format.license.name
+		   >> format.license.file
+		   >> publishers
+		   >> format.deferredHooks
+		   >> format.deferredResources
+		   >> format.externalResources;
+	if(stream.status() != QDataStream::Ok)
+		return false;
+
+	auto pubObj = QJsonDocument::fromJson(publishers).object();
+	for(auto it = pubObj.constBegin(); it != pubObj.constEnd(); it++)
+		format.publishers.insert(it.key(), it.value().toObject());
+
+	data = format;
+	return true;
+}
+
 void QpmxFormat::putDependency(const QpmxDependency &dep)
 {
 	auto depIndex = dependencies.indexOf(dep);
@@ -127,6 +334,27 @@ void QpmxFormat::putDependency(const QpmxDependency &dep)
 	}
 }
 
+void QpmxFormat::putDependencies(const QList<QpmxDependency> &deps)
+{
+	QHash<QpmxDependency, int> depIndexes;
+	depIndexes.reserve(dependencies.size() + deps.size());
+	for(auto i = 0; i < dependencies.size(); i++)
+		depIndexes.insert(dependencies[i], i);
+
+	for(const auto &dep : deps) {
+		auto depIndex = depIndexes.value(dep, -1);
+		if(depIndex == -1) {
+			qDebug().noquote() << tr("Added package %1 to qpmx.json").arg(dep.toString());
+			depIndexes.insert(dep, dependencies.size());
+			dependencies.append(dep);
+		} else {
+			qWarning().noquote() << tr("Package %1 is already a dependency. Replacing with that version")
+									.arg(dep.toString());
+			dependencies[depIndex] = dep;
+		}
+	}
+}
+
 void QpmxFormat::checkDuplicates()
 {
 	checkDuplicatesImpl(dependencies);
@@ -136,6 +364,8 @@ template<typename T>
 void QpmxFormat::checkDuplicatesImpl(const QList<T> &data)
 {
 	static_assert(std::is_base_of<QpmxDependency, T>::value, "checkDuplicates is only available for QpmxDependency classes");
+	QSet<QpmxDependency> known;
+	known.reserve(data.size());
 	for(auto i = 0; i < data.size(); i++) {
 		if(data[i].provider.isEmpty())
 			throw tr("Dependency does not have a provider: %1").arg(data[i].toString());
@@ -144,10 +374,9 @@ void QpmxFormat::checkDuplicatesImpl(const QList<T> &data)
 		if(data[i].version.isNull())
 			throw tr("Dependency does not have a version: %1").arg(data[i].toString());
 
-		if(i < data.size() - 1) {
-			if(data.indexOf(data[i], i + 1) != -1)
-				throw tr("Duplicated dependency found: %1").arg(data[i].toString());
-		}
+		if(known.contains(data[i]))
+			throw tr("Duplicated dependency found: %1").arg(data[i].toString());
+		known.insert(data[i]);
 	}
 }
 
@@ -170,6 +399,11 @@ bool QpmxDevDependency::operator==(const QpmxDependency &other) const
 	return QpmxDependency::operator ==(other);
 }
 
+uint qHash(const QpmxDevDependency &dep, uint seed)
+{
+	return qHash(static_cast<const QpmxDependency&>(dep), seed);
+}
+
 
 
 QpmxDevAlias::QpmxDevAlias() = default;
@@ -201,15 +435,32 @@ QpmxUserFormat::QpmxUserFormat(const QpmxUserFormat &userFormat, const QpmxForma
 {
 	// replace all aliases
 	if(!devAliases.isEmpty()) {
+		QMultiHash<QpmxDependency, QpmxDevAlias> aliasHash;
+		aliasHash.reserve(devAliases.size());
+		for(const auto &alias : qAsConst(devAliases))
+			aliasHash.insert(alias.original, alias);
 		for(auto &dep : dependencies) {
-			auto index = devAliases.indexOf(dep);
-			if(index != -1)
-				dep = devAliases[index].alias;
+			for(auto it = aliasHash.constFind(dep); it != aliasHash.constEnd() && it.key() == dep; it++) {
+				if(it->original.version == dep.version) {
+					dep = it->alias;
+					break;
+				}
+			}
 		}
 	}
 	// remove all dev dep duplicates
-	for(const auto &dep : qAsConst(devDependencies))
-		dependencies.removeOne(dep);
+	if(!devDependencies.isEmpty()) {
+		QSet<QpmxDependency> devSet;
+		devSet.reserve(devDependencies.size());
+		for(const auto &dep : qAsConst(devDependencies))
+			devSet.insert(dep);
+		for(auto it = dependencies.begin(); it != dependencies.end();) {
+			if(devSet.contains(*it))
+				it = dependencies.erase(it);
+			else
+				it++;
+		}
+	}
 }
 
 QList<QpmxDevDependency> QpmxUserFormat::allDeps() const
@@ -236,29 +487,14 @@ QpmxUserFormat QpmxUserFormat::readDefault(bool mustExist)
 QpmxUserFormat QpmxUserFormat::readFile(const QDir &dir, const QString &fileName, bool mustExist)
 {
 	QFile qpmxUserFile(dir.absoluteFilePath(fileName));
-	if(qpmxUserFile.exists()) {
-		if(!qpmxUserFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-			throw tr("Failed to open %1 with error: %2")
-					.arg(qpmxUserFile.fileName(), qpmxUserFile.errorString());
-		}
-
-		try {
-			QJsonSerializer ser;
-			auto format = ser.deserializeFrom<QpmxUserFormat>(&qpmxUserFile);
-			format.checkDuplicates();
-			return format;
-		} catch(QJsonSerializerException &e) {
-			qDebug() << e.what();
-			throw tr("%1 contains invalid data").arg(qpmxUserFile.fileName());
-		}
-	} else if(mustExist)
-		throw tr("%1 does not exist").arg(qpmxUserFile.fileName());
-	else
-		return {};
+	return FormatCache<QpmxUserFormat>::read(qpmxUserFile, mustExist, [](QpmxUserFormat &format) {
+		format.checkDuplicates();
+	});
 }
 
 void QpmxUserFormat::writeUser(const QpmxUserFormat &data)
 {
+	FormatCache<QpmxUserFormat>::invalidate(QDir::current().absoluteFilePath(QStringLiteral("qpmx.json.user")));
 	QSaveFile qpmxUserFile(QDir::current().absoluteFilePath(QStringLiteral("qpmx.json.user")));
 	if(!qpmxUserFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
 		throw tr("Failed to open %1 with error: %2")
@@ -308,60 +544,3 @@ QList<QpmxDevDependency> QpmxUserFormat::readDummy() const
 {
 	return {};
 }
-
-
-
-QpmxCacheFormat::QpmxCacheFormat() = default;
-
-QpmxCacheFormat::QpmxCacheFormat(const QpmxUserFormat &userFormat, QString kitId) :
-	QpmxUserFormat(userFormat),
-	buildKit(std::move(kitId))
-{}
-
-QpmxCacheFormat QpmxCacheFormat::readCached(const QDir &dir)
-{
-	QFile qpmxCacheFile(dir.absoluteFilePath(QStringLiteral(".qpmx.cache")));
-	if(qpmxCacheFile.exists()) {
-		if(!qpmxCacheFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-			throw tr("Failed to open %1 with error: %2")
-					.arg(qpmxCacheFile.fileName(), qpmxCacheFile.errorString());
-		}
-
-		try {
-			QJsonSerializer ser;
-			auto format = ser.deserializeFrom<QpmxCacheFormat>(&qpmxCacheFile);
-			format.checkDuplicates();
-			return format;
-		} catch(QJsonSerializerException &e) {
-			qDebug() << e.what();
-			throw tr("%1 contains invalid data").arg(qpmxCacheFile.fileName());
-		}
-	} else
-		return {};
-}
-
-bool QpmxCacheFormat::writeCached(const QDir &dir, const QpmxCacheFormat &data)
-{
-	QSaveFile qpmxCacheFile(dir.absoluteFilePath(QStringLiteral(".qpmx.cache")));
-	if(!qpmxCacheFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-		qWarning().noquote() << tr("Failed to open %1 with error: %2")
-								.arg(qpmxCacheFile.fileName(), qpmxCacheFile.errorString());
-		return false;
-	}
-
-	try {
-		QJsonSerializer ser;
-		ser.serializeTo(&qpmxCacheFile, data, QJsonDocument::Compact);
-	} catch(QJsonSerializerException &e) {
-		qDebug() << e.what();
-		qWarning().noquote() << tr("Failed to write %1").arg(qpmxCacheFile.fileName());
-		return false;
-	}
-
-	if(!qpmxCacheFile.commit()) {
-		qWarning().noquote() << tr("Failed to save %1 with error: %2")
-								.arg(qpmxCacheFile.fileName(), qpmxCacheFile.errorString());
-		return false;
-	} else
-		return true;
-}
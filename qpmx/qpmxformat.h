@@ -6,6 +6,7 @@
 #include <QCoreApplication>
 #include <QJsonTypeConverter>
 #include <QDir>
+#include <QFileInfo>
 #include <QMap>
 #include <QJsonObject>
 #include <QUuid>
@@ -37,6 +38,8 @@ public:
 	QVersionNumber version;
 };
 
+uint qHash(const QpmxDependency &dep, uint seed = 0);
+
 class QpmxFormatLicense
 {
 	Q_GADGET
@@ -64,6 +67,9 @@ class QpmxFormat
 
 	Q_PROPERTY(QList<QpmxDependency> dependencies MEMBER dependencies)
 	Q_PROPERTY(QStringList priIncludes MEMBER priIncludes)
+	Q_PROPERTY(QStringList deferredHooks MEMBER deferredHooks)
+	Q_PROPERTY(QStringList deferredResources MEMBER deferredResources)
+	Q_PROPERTY(bool externalResources MEMBER externalResources)
 
 	Q_PROPERTY(QpmxFormatLicense license MEMBER license)
 #ifdef Q_MOC_RUN //workaround for clang code model
@@ -71,12 +77,21 @@ class QpmxFormat
 #endif
 
 public:
+	struct ReadStats {
+		int parsed;
+		int binary;
+		int cached;
+	};
+
 	virtual ~QpmxFormat();
 
 	static QpmxFormat readFile(const QDir &dir, bool mustExist = false);
 	static QpmxFormat readFile(const QDir &dir, const QString &fileName, bool mustExist = false);
 	static QpmxFormat readDefault(bool mustExist = false);
 	static void writeDefault(const QpmxFormat &data);
+	static ReadStats readStats();
+	static void resetStats();
+	static void writeBinary(const QDir &dir, const QpmxFormat &data);
 
 	QString priFile;
 	QString prcFile;
@@ -84,15 +99,22 @@ public:
 	bool source = false;
 	QList<QpmxDependency> dependencies;
 	QStringList priIncludes;
+	QStringList deferredHooks;
+	QStringList deferredResources;
+	bool externalResources = false;
 	QpmxFormatLicense license;
 	QMap<QString, QJsonObject> publishers;
 
 	void putDependency(const QpmxDependency &dep);
+	void putDependencies(const QList<QpmxDependency> &deps);
 
 protected:
 	virtual void checkDuplicates();
 	template <typename T>
 	static void checkDuplicatesImpl(const QList<T> &data);
+
+private:
+	static bool readBinary(const QFileInfo &srcInfo, QpmxFormat &data);
 };
 
 class QpmxDevDependency : public QpmxDependency
@@ -112,6 +134,8 @@ public:
 	QString path;
 };
 
+uint qHash(const QpmxDevDependency &dep, uint seed = 0);
+
 class QpmxDevAlias
 {
 	Q_GADGET
@@ -164,29 +188,11 @@ private:
 	QList<QpmxDevDependency> readDummy() const;
 };
 
-class QpmxCacheFormat : public QpmxUserFormat
-{
-	Q_GADGET
-	Q_DECLARE_TR_FUNCTIONS(QpmxCacheFormat)
-
-	Q_PROPERTY(QString buildKit MEMBER buildKit)
-
-public:
-	QpmxCacheFormat();
-	QpmxCacheFormat(const QpmxUserFormat &userFormat, QString kitId);
-
-	static QpmxCacheFormat readCached(const QDir &dir);
-	static bool writeCached(const QDir &dir, const QpmxCacheFormat &data);
-
-	QString buildKit;
-};
-
 Q_DECLARE_METATYPE(QpmxDependency)
 Q_DECLARE_METATYPE(QpmxFormatLicense)
 Q_DECLARE_METATYPE(QpmxFormat)
 Q_DECLARE_METATYPE(QpmxDevDependency)
 Q_DECLARE_METATYPE(QpmxDevAlias)
 Q_DECLARE_METATYPE(QpmxUserFormat)
-Q_DECLARE_METATYPE(QpmxCacheFormat)
 
 #endif // QPMXFORMAT_H
@@ -1,6 +1,9 @@
 #include "searchcommand.h"
+#include "searchindex.h"
+#include <QDateTime>
+#include <QProcess>
+#include <QSaveFile>
 #include <iostream>
-#include <qtcoroutine.h>
 using namespace qpmx;
 
 #define print(x) std::cout << QString(x).toStdString() << std::endl
@@ -33,6 +36,13 @@ QSharedPointer<QCliNode> SearchCommand::createCliNode() const
 							  QStringLiteral("short"),
 							  QStringLiteral("Only list package names (with provider) as space seperated list, no category based listing.")
 						  });
+	searchNode->addOption({
+							  QStringLiteral("live"),
+							  tr("Do not use the local search index. Instead, query all providers directly and wait for their results.")
+						  });
+	QCommandLineOption updateOpt{QStringLiteral("update-index")};
+	updateOpt.setFlags(QCommandLineOption::HiddenFromHelp);
+	searchNode->addOption(updateOpt);
 	searchNode->addPositionalArgument(QStringLiteral("query"),
 									  tr("The query to search by. Typically, a \"contains\" search is "
 										 "performed, but some providers may support wildcard or regex expressions. "
@@ -44,16 +54,19 @@ void SearchCommand::initialize(QCliParser &parser)
 {
 	try {
 		_short = parser.isSet(QStringLiteral("short"));
+		_updateOnly = parser.isSet(QStringLiteral("update-index"));
 
 		if(parser.positionalArguments().isEmpty())
 			throw tr("You must specify a search query to perform a search");
 		auto query = parser.positionalArguments().join(QLatin1Char(' '));
 
-		auto providers = parser.values(QStringLiteral("provider"));
-		if(!providers.isEmpty()) {
-			for(const auto &provider : providers) {
+		auto indexProviders = parser.values(QStringLiteral("provider"));
+		QStringList providers;
+		if(!indexProviders.isEmpty()) {
+			for(const auto &provider : indexProviders) {
 				if(!registry()->sourcePlugin(provider)->canSearch(provider))
 					throw tr("Provider %{bld}%1%{end} does not support searching").arg(provider);
+				providers.append(provider);
 			}
 		} else {
 			for(const auto &provider : registry()->providerNames()) {
@@ -63,28 +76,164 @@ void SearchCommand::initialize(QCliParser &parser)
 			xDebug() << tr("Searching providers: %1").arg(providers.join(tr(", ")));
 		}
 
-		performSearch(query, providers);
+		if(_updateOnly) {
+			performSearch(query, providers);
+			updateIndex(query);
+		} else if(!parser.isSet(QStringLiteral("live")) &&
+				  indexSearch(query, indexProviders)) {
+			printResult();
+			refreshIndex(query, providers);
+		} else {
+			performSearch(query, providers);
+			updateIndex(query);
+			printResult();
+		}
+		quit();
 	} catch(QString &s) {
 		xCritical() << s;
 	}
 }
 
+bool SearchCommand::indexSearch(const QString &query, const QStringList &providers)
+{
+	SearchIndex index{indexPath()};
+	if(!index.open() || index.isEmpty()) {
+		xDebug() << tr("Search index is empty - searching providers directly");
+		return false;
+	}
+
+	auto results = index.search(query, providers);
+	if(results.isEmpty()) {
+		xDebug() << tr("No matches in search index - searching providers directly");
+		return false;
+	}
+
+	xDebug() << tr("Found %n result(s) in the search index", "", results.size());
+	QHash<QString, int> providerIndex;
+	for(const auto &result : results) {
+		auto pIndex = providerIndex.value(result.provider, -1);
+		if(pIndex == -1) {
+			pIndex = _searchResults.size();
+			providerIndex.insert(result.provider, pIndex);
+			_searchResults.append({result.provider, {}});
+		}
+		_searchResults[pIndex].second.append(result.package);
+	}
+	return true;
+}
+
 void SearchCommand::performSearch(const QString &query, const QStringList &providers)
 {
-	QtCoroutine::awaitEach(providers, [this, query](const QString &provider){
-		try {
-			auto plg = registry()->sourcePlugin(provider);
-			auto packageNames = plg->searchPackage(provider, query);
-			xDebug() << tr("Found %n result(s) for provider %{bld}%1%{end}", "", packageNames.size()).arg(provider);
-			if(!packageNames.isEmpty())
-				_searchResults.append({provider, packageNames});
-		} catch(qpmx::SourcePluginException &e) {
-			throw tr("Failed to search provider %{bld}%1%{end} with error: %2")
-					.arg(provider, e.qWhat());
+	TaskGroup group{this};
+	for(const auto &provider : providers) {
+		group.run(provider, [this, query, provider](){
+			try {
+				auto plg = registry()->sourcePlugin(provider);
+				auto packageNames = plg->searchPackage(provider, query);
+				xDebug() << tr("Found %n result(s) for provider %{bld}%1%{end}", "", packageNames.size()).arg(provider);
+				_searchedProviders.insert(provider);
+				if(!packageNames.isEmpty())
+					_searchResults.append({provider, packageNames});
+			} catch(qpmx::SourcePluginException &e) {
+				auto error = tr("Failed to search provider %{bld}%1%{end} with error: %2")
+							 .arg(provider, e.qWhat());
+				if(_updateOnly)
+					xWarning() << error;
+				else
+					throw error;
+			}
+		});
+	}
+	group.wait();
+}
+
+void SearchCommand::updateIndex(const QString &query)
+{
+	auto lock = searchIndexLock();
+
+	//entries of providers that cannot search come from the source cache only, and are re-added below.
+	//searched providers returned all current matches of the query, so older matches are dropped
+	QHash<QString, bool> searchable;
+	for(const auto &provider : registry()->providerNames())
+		searchable.insert(provider, registry()->sourcePlugin(provider)->canSearch(provider));
+	QList<SearchIndex::Entry> entries;
+	{
+		SearchIndex index{indexPath()};
+		if(index.open()) {
+			for(const auto &entry : index.entries()) {
+				if(!searchable.value(entry.provider))
+					continue;
+				if(_searchedProviders.contains(entry.provider) &&
+				   entry.package.contains(query, Qt::CaseInsensitive))
+					continue;
+				entries.append(entry);
+			}
 		}
-	});
+	}
+
+	for(const auto &res : qAsConst(_searchResults)) {
+		for(const auto &pkg : res.second)
+			entries.append({res.first, pkg});
+	}
 
-	printResult();
+	//add all packages that have been downloaded before, including non-searchable providers
+	auto sDir = srcDir();
+	for(const auto &provider : sDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::Readable)) {
+		QDir pDir{sDir.absoluteFilePath(provider)};
+		for(const auto &pkg : pDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::Readable))
+			entries.append({provider, pkgDecode(pkg)});
+	}
+
+	SearchIndex::write(indexPath(), entries);
+	xDebug() << tr("Updated search index");
+}
+
+void SearchCommand::refreshIndex(const QString &query, const QStringList &providers)
+{
+	//at most one background refresh per interval, no matter how many searches hit the index
+	auto stampPath = indexPath() + QStringLiteral(".refresh");
+	auto interval = settings()->value(QStringLiteral("search-refresh-interval"), 600).toLongLong() * 1000;
+	QFileInfo stampInfo{stampPath};
+	if(stampInfo.exists() &&
+	   stampInfo.lastModified().msecsTo(QDateTime::currentDateTime()) < interval) {
+		xDebug() << tr("Search index was refreshed recently - skipping background refresh");
+		return;
+	}
+	QSaveFile stampFile{stampPath};
+	if(!stampFile.open(QIODevice::WriteOnly) ||
+	   stampFile.write(QDateTime::currentDateTimeUtc().toString(Qt::ISODate).toUtf8()) == -1 ||
+	   !stampFile.commit())
+		xDebug() << tr("Failed to write search index refresh timestamp");
+
+	QStringList arguments {
+		commandName(),
+		QStringLiteral("--update-index")
+	};
+	for(const auto &provider : providers)
+		arguments << QStringLiteral("--provider") << provider;
+	arguments.append(query);
+
+	xDebug() << tr("Refreshing search index in the background");
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+	QProcess proc;
+	proc.setProgram(QCoreApplication::applicationFilePath());
+	proc.setArguments(arguments);
+	proc.setStandardInputFile(QProcess::nullDevice());
+	proc.setStandardOutputFile(QProcess::nullDevice());
+	proc.setStandardErrorFile(QProcess::nullDevice());
+	if(!proc.startDetached())
+#else
+	if(!QProcess::startDetached(QCoreApplication::applicationFilePath(), arguments))
+#endif
+		xWarning() << tr("Failed to start background refresh of the search index");
+}
+
+QString SearchCommand::indexPath() const
+{
+	auto dir = cacheDir();
+	if(!dir.mkpath(QStringLiteral(".")))
+		throw tr("Failed to create cache directory");
+	return dir.absoluteFilePath(QStringLiteral("search.idx"));
 }
 
 void SearchCommand::printResult()
@@ -103,6 +252,4 @@ void SearchCommand::printResult()
 				print(tr(" %1").arg(pkg));
 		}
 	}
-
-	qApp->quit();
 }
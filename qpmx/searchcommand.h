@@ -3,6 +3,8 @@
 
 #include "command.h"
 
+#include <QSet>
+
 class SearchCommand : public Command
 {
 	Q_OBJECT
@@ -19,9 +21,15 @@ protected slots:
 
 private:
 	bool _short = false;
+	bool _updateOnly = false;
 	QList<QPair<QString, QStringList>> _searchResults;
+	QSet<QString> _searchedProviders;
 
+	bool indexSearch(const QString &query, const QStringList &providers);
 	void performSearch(const QString &query, const QStringList &providers);
+	void updateIndex(const QString &query);
+	void refreshIndex(const QString &query, const QStringList &providers);
+	QString indexPath() const;
 	void printResult();
 };
 
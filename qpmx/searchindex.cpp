@@ -0,0 +1,279 @@
+#include "searchindex.h"
+#include <QHash>
+#include <QMap>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSet>
+#include <QVector>
+#include <QtEndian>
+#include <algorithm>
+
+const quint32 SearchIndex::IndexMagic = 0x51505853;
+const quint32 SearchIndex::IndexVersion = 1;
+const int SearchIndex::HeaderSize = static_cast<int>(6 * sizeof(quint32));
+
+namespace {
+
+void append32(QByteArray &data, quint32 value)
+{
+	uchar buffer[sizeof(quint32)];
+	qToLittleEndian(value, buffer);
+	data.append(reinterpret_cast<const char*>(buffer), sizeof(quint32));
+}
+
+}
+
+SearchIndex::SearchIndex(const QString &path) :
+	_file(path),
+	_data(nullptr),
+	_size(0),
+	_entryCount(0),
+	_trigramCount(0),
+	_postingCount(0),
+	_entries(nullptr),
+	_trigrams(nullptr),
+	_postings(nullptr),
+	_strings(nullptr),
+	_stringSize(0)
+{}
+
+SearchIndex::~SearchIndex()
+{
+	if(_data)
+		_file.unmap(const_cast<uchar*>(_data));
+}
+
+bool SearchIndex::open()
+{
+	if(!_file.exists() || !_file.open(QIODevice::ReadOnly))
+		return false;
+	_size = _file.size();
+	if(_size < HeaderSize)
+		return false;
+	_data = _file.map(0, _size);
+	if(!_data)
+		return false;
+
+	if(read32(_data, 0) != IndexMagic ||
+	   read32(_data, 1) != IndexVersion)
+		return false;
+	_entryCount = read32(_data, 2);
+	_trigramCount = read32(_data, 3);
+	_postingCount = read32(_data, 4);
+	_stringSize = read32(_data, 5);
+
+	auto required = static_cast<qint64>(HeaderSize) +
+					static_cast<qint64>(_entryCount) * 2 * sizeof(quint32) +
+					static_cast<qint64>(_trigramCount) * 3 * sizeof(quint32) +
+					static_cast<qint64>(_postingCount) * sizeof(quint32) +
+					static_cast<qint64>(_stringSize);
+	if(required > _size) {
+		_entryCount = 0;
+		_trigramCount = 0;
+		return false;
+	}
+
+	_entries = _data + HeaderSize;
+	_trigrams = _entries + _entryCount * 2 * sizeof(quint32);
+	_postings = _trigrams + _trigramCount * 3 * sizeof(quint32);
+	_strings = _postings + _postingCount * sizeof(quint32);
+	return true;
+}
+
+bool SearchIndex::isEmpty() const
+{
+	return _entryCount == 0;
+}
+
+QList<SearchIndex::Entry> SearchIndex::entries() const
+{
+	QList<Entry> res;
+	res.reserve(static_cast<int>(_entryCount));
+	for(quint32 i = 0; i < _entryCount; i++)
+		res.append(entry(i));
+	return res;
+}
+
+QList<SearchIndex::Result> SearchIndex::search(const QString &query, const QStringList &providers) const
+{
+	auto lQuery = query.toLower();
+	auto qTrigrams = trigrams(lQuery);
+
+	QHash<quint32, int> hits;
+	if(qTrigrams.isEmpty()) {
+		for(quint32 i = 0; i < _entryCount; i++)
+			hits.insert(i, 0);
+	} else {
+		for(auto key : qTrigrams) {
+			//binary search the sorted trigram table
+			quint32 first = 0;
+			quint32 last = _trigramCount;
+			while(first < last) {
+				auto mid = first + (last - first) / 2;
+				if(read32(_trigrams, mid * 3) < key)
+					first = mid + 1;
+				else
+					last = mid;
+			}
+			if(first == _trigramCount || read32(_trigrams, first * 3) != key)
+				continue;
+
+			auto pBegin = read32(_trigrams, first * 3 + 1);
+			auto pCount = read32(_trigrams, first * 3 + 2);
+			for(quint32 i = 0; i < pCount && pBegin + i < _postingCount; i++)
+				hits[read32(_postings, pBegin + i)]++;
+		}
+	}
+
+	QList<Result> results;
+	for(auto it = hits.constBegin(); it != hits.constEnd(); it++) {
+		if(it.key() >= _entryCount)
+			continue;
+		auto e = entry(it.key());
+		if(!providers.isEmpty() && !providers.contains(e.provider))
+			continue;
+
+		auto overlap = qTrigrams.isEmpty() ?
+						   0.0 :
+						   static_cast<double>(it.value()) / qTrigrams.size();
+		auto score = rank(e.package.toLower(), lQuery, overlap);
+		if(score >= 0.5)
+			results.append({e.provider, e.package, score});
+	}
+
+	std::sort(results.begin(), results.end(), [](const Result &lhs, const Result &rhs){
+		if(lhs.score != rhs.score)
+			return lhs.score > rhs.score;
+		if(lhs.provider != rhs.provider)
+			return lhs.provider < rhs.provider;
+		return lhs.package < rhs.package;
+	});
+	return results;
+}
+
+void SearchIndex::write(const QString &path, const QList<Entry> &entries)
+{
+	QList<Entry> sorted;
+	sorted.reserve(entries.size());
+	QSet<QString> known;
+	known.reserve(entries.size());
+	for(const auto &e : entries) {
+		auto key = e.provider + QLatin1Char('\n') + e.package;
+		if(!known.contains(key)) {
+			known.insert(key);
+			sorted.append(e);
+		}
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const Entry &lhs, const Entry &rhs){
+		if(lhs.provider != rhs.provider)
+			return lhs.provider < rhs.provider;
+		return lhs.package < rhs.package;
+	});
+
+	QByteArray entryData;
+	QByteArray stringData;
+	QHash<QString, quint32> stringOffsets;
+	QMap<quint32, QVector<quint32>> trigramMap;
+	auto addString = [&](const QString &str) {
+		auto it = stringOffsets.constFind(str);
+		if(it != stringOffsets.constEnd())
+			return *it;
+		auto offset = static_cast<quint32>(stringData.size());
+		auto utf8 = str.toUtf8();
+		append32(stringData, static_cast<quint32>(utf8.size()));
+		stringData.append(utf8);
+		stringOffsets.insert(str, offset);
+		return offset;
+	};
+
+	for(auto i = 0; i < sorted.size(); i++) {
+		const auto &e = sorted[i];
+		append32(entryData, addString(e.provider));
+		append32(entryData, addString(e.package));
+		for(auto key : trigrams(e.package.toLower()))
+			trigramMap[key].append(static_cast<quint32>(i));
+	}
+
+	QByteArray trigramData;
+	QByteArray postingData;
+	quint32 postingCount = 0;
+	for(auto it = trigramMap.constBegin(); it != trigramMap.constEnd(); it++) {
+		append32(trigramData, it.key());
+		append32(trigramData, postingCount);
+		append32(trigramData, static_cast<quint32>(it->size()));
+		for(auto id : *it)
+			append32(postingData, id);
+		postingCount += static_cast<quint32>(it->size());
+	}
+
+	QSaveFile indexFile{path};
+	if(!indexFile.open(QIODevice::WriteOnly))
+		throw tr("Failed to open search index for writing with error: %1").arg(indexFile.errorString());
+
+	QByteArray header;
+	append32(header, IndexMagic);
+	append32(header, IndexVersion);
+	append32(header, static_cast<quint32>(sorted.size()));
+	append32(header, static_cast<quint32>(trigramMap.size()));
+	append32(header, postingCount);
+	append32(header, static_cast<quint32>(stringData.size()));
+	indexFile.write(header);
+	indexFile.write(entryData);
+	indexFile.write(trigramData);
+	indexFile.write(postingData);
+	indexFile.write(stringData);
+	if(!indexFile.commit())
+		throw tr("Failed to save search index with error: %1").arg(indexFile.errorString());
+}
+
+quint32 SearchIndex::read32(const uchar *base, quint32 index) const
+{
+	return qFromLittleEndian<quint32>(base + index * sizeof(quint32));
+}
+
+QString SearchIndex::readString(quint32 offset) const
+{
+	if(static_cast<quint64>(offset) + sizeof(quint32) > _stringSize)
+		return {};
+	auto len = qFromLittleEndian<quint32>(_strings + offset);
+	if(static_cast<quint64>(offset) + sizeof(quint32) + len > _stringSize)
+		return {};
+	return QString::fromUtf8(reinterpret_cast<const char*>(_strings + offset + sizeof(quint32)),
+							 static_cast<int>(len));
+}
+
+SearchIndex::Entry SearchIndex::entry(quint32 index) const
+{
+	return {
+		readString(read32(_entries, index * 2)),
+		readString(read32(_entries, index * 2 + 1))
+	};
+}
+
+double SearchIndex::rank(const QString &package, const QString &query, double overlap) const
+{
+	auto score = overlap;
+	if(package == query)
+		score += 3.0;
+	else if(package.contains(query)) {
+		score += 1.0;
+		auto segment = package.mid(package.lastIndexOf(QRegularExpression{QStringLiteral("[./]")}) + 1);
+		if(package.startsWith(query) || segment.startsWith(query))
+			score += 0.5;
+	}
+	return score;
+}
+
+QList<quint32> SearchIndex::trigrams(const QString &text)
+{
+	auto data = text.toUtf8();
+	QList<quint32> keys;
+	for(auto i = 0; i + 2 < data.size(); i++) {
+		keys.append((static_cast<quint32>(static_cast<uchar>(data[i])) << 16) |
+					(static_cast<quint32>(static_cast<uchar>(data[i + 1])) << 8) |
+					static_cast<quint32>(static_cast<uchar>(data[i + 2])));
+	}
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	return keys;
+}
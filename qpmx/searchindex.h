@@ -0,0 +1,62 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QList>
+#include <QStringList>
+
+class SearchIndex
+{
+	Q_DECLARE_TR_FUNCTIONS(SearchIndex)
+
+public:
+	struct Entry {
+		QString provider;
+		QString package;
+	};
+
+	struct Result {
+		QString provider;
+		QString package;
+		double score;
+	};
+
+	explicit SearchIndex(const QString &path);
+	~SearchIndex();
+
+	bool open();
+	bool isEmpty() const;
+
+	QList<Entry> entries() const;
+	QList<Result> search(const QString &query, const QStringList &providers = {}) const;
+
+	static void write(const QString &path, const QList<Entry> &entries);
+
+private:
+	static const quint32 IndexMagic;
+	static const quint32 IndexVersion;
+	static const int HeaderSize;
+
+	QFile _file;
+	const uchar *_data;
+	qint64 _size;
+
+	quint32 _entryCount;
+	quint32 _trigramCount;
+	quint32 _postingCount;
+	const uchar *_entries;
+	const uchar *_trigrams;
+	const uchar *_postings;
+	const uchar *_strings;
+	quint32 _stringSize;
+
+	quint32 read32(const uchar *base, quint32 index) const;
+	QString readString(quint32 offset) const;
+	Entry entry(quint32 index) const;
+	double rank(const QString &package, const QString &query, double overlap) const;
+
+	static QList<quint32> trigrams(const QString &text);
+};
+
+#endif // SEARCHINDEX_H
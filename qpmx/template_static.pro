@@ -26,7 +26,30 @@ hook_compiler.output = $$OUT_PWD/.srccache/${QMAKE_FILE_BASE}${QMAKE_FILE_EXT}
 QMAKE_EXTRA_COMPILERS += hook_compiler
 
 # resources
-!isEmpty(RESOURCES): write_file($$OUT_PWD/.qpmx_resources, RESOURCES)
+!isEmpty(QPMX_EXTERNAL_RESOURCES):!isEmpty(RESOURCES) {
+	# built as binary rcc files next to the library instead of into it
+	qtPrepareTool(QPMX_RCC, rcc)
+	QPMX_RCC_RESOURCES = $$RESOURCES
+	RESOURCES =
+	write_file($$OUT_PWD/.qpmx_external_resources, QPMX_RCC_RESOURCES)
+
+	rcc_compiler.name = rcc ${QMAKE_FILE_IN}
+	rcc_compiler.input = QPMX_RCC_RESOURCES
+	rcc_compiler.commands = $$QPMX_RCC -binary ${QMAKE_FILE_IN} -o ${QMAKE_FILE_OUT}
+	rcc_compiler.depend_command = $$QPMX_RCC -list ${QMAKE_FILE_IN}
+	rcc_compiler.output = $$OUT_PWD/$${QPMX_RCC_PREFIX}${QMAKE_FILE_BASE}.rcc
+	rcc_compiler.CONFIG += no_link target_predeps
+	QMAKE_EXTRA_COMPILERS += rcc_compiler
+
+	rcc_install.path = $$QPMX_INSTALL/resources
+	rcc_install.CONFIG += no_check_exist
+	rcc_install.depends += compiler_rcc_compiler_make_all
+	for(res, QPMX_RCC_RESOURCES) {
+		resBase = $$basename(res)
+		rcc_install.files += "$$OUT_PWD/$${QPMX_RCC_PREFIX}$$replace(resBase, \.qrc, .rcc)"
+	}
+	INSTALLS += rcc_install
+} else: !isEmpty(RESOURCES): write_file($$OUT_PWD/.qpmx_resources, RESOURCES)
 
 # install stuff
 isEmpty(PUBLIC_HEADERS): PUBLIC_HEADERS = $$HEADERS
@@ -3,125 +3,341 @@
 
 #include <QHash>
 #include <QList>
-#include <QQueue>
+#include <QPair>
 #include <QVector>
 #include <functional>
+#include <type_traits>
 
-template <typename T>
+namespace TopSortPrivate {
+
+template <typename T, typename Key>
+struct DefaultKey {
+	static_assert(std::is_convertible<T, Key>::value, "TopSort needs a key function for types that are not convertible to Key");
+
+	static Key key(const T &data) {
+		return data;
+	}
+};
+
+}
+
+template <typename T, typename Key = T>
 class TopSort
 {
 public:
+	using KeyFunction = std::function<Key(const T&)>;
+
 	TopSort();
-	TopSort(const QList<T> &list, const std::function<bool(const T&,const T&)> &comparator = {});
+	explicit TopSort(const KeyFunction &keyFn);
+	TopSort(const QList<T> &list);
+	TopSort(const QList<T> &list, const KeyFunction &keyFn);
+
+	int size() const;
+	const T &at(int index) const;
 
-	void addData(const T &data);
+	int addData(const T &data);
 	bool contains(const T &data) const;
+	int indexOf(const T &data) const;
 
 	void addDependency(int from, int to);
 	void addDependency(const T &from, const T &to);
 
 	QList<T> sort() const;
+	QList<QList<T>> levels() const;
+	QList<T> cycle() const;
+	QList<QList<T>> components() const;
 
 private:
-	const std::function<bool(const T&,const T&)> _comparator;
-	QList<T> _data;
-	QMultiHash<int, int> _dependencies;
+	struct Adjacency {
+		QVector<int> offsets;
+		QVector<int> targets;
+	};
 
-	int indexOf(const T &data) const;
+	const KeyFunction _keyFn;
+	QVector<T> _data;
+	QHash<Key, int> _index;
+	QVector<QPair<int, int>> _dependencies;
+
+	Adjacency adjacency() const;
+	QVector<int> topOrder(const Adjacency &adj) const;
 };
 
 // ------------- Implementation -------------
 
-template<typename T>
-TopSort<T>::TopSort() :
-	_data(),
-	_dependencies()
+template<typename T, typename Key>
+TopSort<T, Key>::TopSort() :
+	TopSort(KeyFunction{&TopSortPrivate::DefaultKey<T, Key>::key})
 {}
 
-template<typename T>
-TopSort<T>::TopSort(const QList<T> &list, const std::function<bool(const T & ,const T &)> &comparator) :
-	_comparator(comparator ? comparator : [](const T &a, const T &b){ return a == b; }),
-	_data(list),
+template<typename T, typename Key>
+TopSort<T, Key>::TopSort(const KeyFunction &keyFn) :
+	_keyFn(keyFn),
+	_data(),
+	_index(),
 	_dependencies()
+{
+	Q_ASSERT_X(_keyFn, Q_FUNC_INFO, "key function must not be empty");
+}
+
+template<typename T, typename Key>
+TopSort<T, Key>::TopSort(const QList<T> &list) :
+	TopSort(list, KeyFunction{&TopSortPrivate::DefaultKey<T, Key>::key})
 {}
 
-template<typename T>
-void TopSort<T>::addData(const T &data)
+template<typename T, typename Key>
+TopSort<T, Key>::TopSort(const QList<T> &list, const KeyFunction &keyFn) :
+	TopSort(keyFn)
 {
+	_data.reserve(list.size());
+	_index.reserve(list.size());
+	for(const auto &data : list)
+		addData(data);
+}
+
+template<typename T, typename Key>
+int TopSort<T, Key>::size() const
+{
+	return _data.size();
+}
+
+template<typename T, typename Key>
+const T &TopSort<T, Key>::at(int index) const
+{
+	return _data[index];
+}
+
+template<typename T, typename Key>
+int TopSort<T, Key>::addData(const T &data)
+{
+	auto key = _keyFn(data);
+	auto it = _index.constFind(key);
+	if(it != _index.constEnd())
+		return *it;
+	_index.insert(key, _data.size());
 	_data.append(data);
+	return _data.size() - 1;
 }
 
-template<typename T>
-bool TopSort<T>::contains(const T &data) const
+template<typename T, typename Key>
+bool TopSort<T, Key>::contains(const T &data) const
 {
-	return indexOf(data) != -1;
+	return _index.contains(_keyFn(data));
 }
 
-template<typename T>
-void TopSort<T>::addDependency(int from, int to)
+template<typename T, typename Key>
+int TopSort<T, Key>::indexOf(const T &data) const
 {
-	Q_ASSERT_X(from < _data.size(), Q_FUNC_INFO, "from index is not valid");
-	Q_ASSERT_X(to < _data.size(), Q_FUNC_INFO, "to index is not valid");
-	_dependencies.insert(from, to);
+	return _index.value(_keyFn(data), -1);
 }
 
-template<typename T>
-void TopSort<T>::addDependency(const T &from, const T &to)
+template<typename T, typename Key>
+void TopSort<T, Key>::addDependency(int from, int to)
+{
+	Q_ASSERT_X(from >= 0 && from < _data.size(), Q_FUNC_INFO, "from index is not valid");
+	Q_ASSERT_X(to >= 0 && to < _data.size(), Q_FUNC_INFO, "to index is not valid");
+	_dependencies.append({from, to});
+}
+
+template<typename T, typename Key>
+void TopSort<T, Key>::addDependency(const T &from, const T &to)
 {
 	addDependency(indexOf(from), indexOf(to));
 }
 
 // http://www.geeksforgeeks.org/topological-sorting-indegree-based-solution/
-template<typename T>
-QList<T> TopSort<T>::sort() const
+template<typename T, typename Key>
+QList<T> TopSort<T, Key>::sort() const
 {
-	// Create a vector to store indegrees of all vertices. Initialize all indegrees as 0
-	QVector<int> inDegree(_data.size(), 0);
+	auto order = topOrder(adjacency());
+	// Check if there was a cycle
+	if(order.size() != _data.size())
+		return {};
+
+	// generate result list - dependencies first
+	QList<T> result;
+	result.reserve(order.size());
+	for(auto i = order.size() - 1; i >= 0; i--)
+		result.append(_data[order[i]]);
+	return result;
+}
 
-	// fill indegrees of vertices -> foreach dep, incease count of target
-	for(auto it = _dependencies.begin(); it != _dependencies.end(); it++)
-		inDegree[it.value()]++;
+template<typename T, typename Key>
+QList<QList<T>> TopSort<T, Key>::levels() const
+{
+	auto adj = adjacency();
+	auto order = topOrder(adj);
+	if(order.size() != _data.size())
+		return {};
 
-	// Create an queue and enqueue all with indegree 0
-	QQueue<int> queue;
-	for(auto i = 0; i < inDegree.size(); i++)
-		if(inDegree[i] == 0)
-			queue.enqueue(i);
+	// a node can be processed as soon as all of its dependencies are -> one level above the highest dependency
+	QVector<int> level(_data.size(), 0);
+	auto maxLevel = -1;
+	for(auto i = order.size() - 1; i >= 0; i--) {
+		auto u = order[i];
+		for(auto e = adj.offsets[u]; e < adj.offsets[u + 1]; e++)
+			level[u] = qMax(level[u], level[adj.targets[e]] + 1);
+		maxLevel = qMax(maxLevel, level[u]);
+	}
 
-	QList<int> topOrder;
-	// One by one dequeue vertices from queue and enqueue if indegree becomes 0
-	while (!queue.isEmpty())
-	{
-		// dequeue and add it to topological order
-		auto u = queue.dequeue();
-		topOrder.append(u);
-
-		// reduce all deps indegree by 1 and enque ones with 0
-		for(auto dep : _dependencies.values(u)) {
-			if (--inDegree[dep] == 0)
-				queue.enqueue(dep);
+	QList<QList<T>> result;
+	result.reserve(maxLevel + 1);
+	for(auto i = 0; i <= maxLevel; i++)
+		result.append(QList<T>{});
+	for(auto i = 0; i < _data.size(); i++)
+		result[level[i]].append(_data[i]);
+	return result;
+}
+
+template<typename T, typename Key>
+QList<T> TopSort<T, Key>::cycle() const
+{
+	enum Color {
+		White,
+		Gray,
+		Black
+	};
+
+	auto adj = adjacency();
+	QVector<Color> color(_data.size(), White);
+	QVector<int> parent(_data.size(), -1);
+	QVector<int> nextEdge(_data.size(), 0);
+	QVector<int> stack;
+	for(auto root = 0; root < _data.size(); root++) {
+		if(color[root] != White)
+			continue;
+
+		// iterative dfs to find a back edge
+		color[root] = Gray;
+		nextEdge[root] = adj.offsets[root];
+		stack.append(root);
+		while(!stack.isEmpty()) {
+			auto u = stack.last();
+			if(nextEdge[u] == adj.offsets[u + 1]) {
+				color[u] = Black;
+				stack.removeLast();
+				continue;
+			}
+
+			auto v = adj.targets[nextEdge[u]++];
+			if(color[v] == White) {
+				color[v] = Gray;
+				parent[v] = u;
+				nextEdge[v] = adj.offsets[v];
+				stack.append(v);
+			} else if(color[v] == Gray) {
+				// back edge u -> v: the cycle is v -> ... -> u -> v
+				QList<T> path;
+				for(auto n = u; n != v; n = parent[n])
+					path.prepend(_data[n]);
+				path.prepend(_data[v]);
+				path.append(_data[v]);
+				return path;
+			}
 		}
 	}
 
-	// Check if there was a cycle
-	if (topOrder.size() != _data.size())
-		return {};
+	return {};
+}
 
-	// generate result list
-	QList<T> result;
-	for(auto i : topOrder)
-		result.prepend(_data[i]);
+template<typename T, typename Key>
+QList<QList<T>> TopSort<T, Key>::components() const
+{
+	// iterative tarjan - a component is completed after all components it depends on, so dependencies come first
+	auto adj = adjacency();
+	QVector<int> index(_data.size(), -1);
+	QVector<int> lowLink(_data.size(), 0);
+	QVector<int> nextEdge(_data.size(), 0);
+	QVector<bool> onStack(_data.size(), false);
+	QVector<int> stack;
+	QVector<int> callStack;
+	auto counter = 0;
+
+	QList<QList<T>> result;
+	for(auto root = 0; root < _data.size(); root++) {
+		if(index[root] != -1)
+			continue;
+
+		index[root] = lowLink[root] = counter++;
+		nextEdge[root] = adj.offsets[root];
+		stack.append(root);
+		onStack[root] = true;
+		callStack.append(root);
+		while(!callStack.isEmpty()) {
+			auto u = callStack.last();
+			if(nextEdge[u] < adj.offsets[u + 1]) {
+				auto v = adj.targets[nextEdge[u]++];
+				if(index[v] == -1) {
+					index[v] = lowLink[v] = counter++;
+					nextEdge[v] = adj.offsets[v];
+					stack.append(v);
+					onStack[v] = true;
+					callStack.append(v);
+				} else if(onStack[v])
+					lowLink[u] = qMin(lowLink[u], index[v]);
+				continue;
+			}
+
+			callStack.removeLast();
+			if(!callStack.isEmpty())
+				lowLink[callStack.last()] = qMin(lowLink[callStack.last()], lowLink[u]);
+			if(lowLink[u] == index[u]) {
+				QList<T> component;
+				int v;
+				do {
+					v = stack.takeLast();
+					onStack[v] = false;
+					component.prepend(_data[v]);
+				} while(v != u);
+				result.append(component);
+			}
+		}
+	}
 	return result;
 }
 
-template<typename T>
-int TopSort<T>::indexOf(const T &data) const
+template<typename T, typename Key>
+typename TopSort<T, Key>::Adjacency TopSort<T, Key>::adjacency() const
+{
+	// compressed adjacency: the deps of u are targets[offsets[u]] ... targets[offsets[u + 1] - 1]
+	Adjacency adj;
+	adj.offsets.fill(0, _data.size() + 1);
+	for(const auto &dep : _dependencies)
+		adj.offsets[dep.first + 1]++;
+	for(auto i = 0; i < _data.size(); i++)
+		adj.offsets[i + 1] += adj.offsets[i];
+
+	adj.targets.resize(_dependencies.size());
+	auto fill = adj.offsets;
+	for(const auto &dep : _dependencies)
+		adj.targets[fill[dep.first]++] = dep.second;
+	return adj;
+}
+
+template<typename T, typename Key>
+QVector<int> TopSort<T, Key>::topOrder(const Adjacency &adj) const
 {
-	for(int i = 0, m = _data.size(); i < m; i++) {
-		if(_comparator(data, _data[i]))
-			return i;
+	// Create a vector to store indegrees of all vertices. Initialize all indegrees as 0
+	QVector<int> inDegree(_data.size(), 0);
+	for(auto target : adj.targets)
+		inDegree[target]++;
+
+	// Create a queue and enqueue all with indegree 0 - the queue is the result vector itself
+	QVector<int> order;
+	order.reserve(_data.size());
+	for(auto i = 0; i < inDegree.size(); i++) {
+		if(inDegree[i] == 0)
+			order.append(i);
+	}
+
+	// One by one dequeue vertices from queue and enqueue if indegree becomes 0
+	for(auto head = 0; head < order.size(); head++) {
+		auto u = order[head];
+		for(auto e = adj.offsets[u]; e < adj.offsets[u + 1]; e++) {
+			if(--inDegree[adj.targets[e]] == 0)
+				order.append(adj.targets[e]);
+		}
 	}
-	return -1;
+	return order;
 }
 
 #endif // TOPSORT_H
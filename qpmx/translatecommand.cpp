@@ -1,12 +1,43 @@
 #include "translatecommand.h"
+#include "qmfile.h"
 
+#include <QCryptographicHash>
 #include <QStandardPaths>
 #include <QProcess>
+#include <QRunnable>
+#include <QThreadPool>
 #include <iostream>
 
 #include <qtcoawaitables.h>
 using namespace qpmx;
 
+namespace {
+
+class QmParser : public QRunnable
+{
+public:
+	QmParser(const QByteArray &data, QmFile &result, QString &error) :
+		_data{data},
+		_result{result},
+		_error{error}
+	{}
+
+	void run() override {
+		try {
+			_result = QmFile::parse(_data);
+		} catch(QString &s) {
+			_error = s;
+		}
+	}
+
+private:
+	const QByteArray &_data;
+	QmFile &_result;
+	QString &_error;
+};
+
+}
+
 TranslateCommand::TranslateCommand(QObject *parent) :
 	Command{parent}
 {}
@@ -103,7 +134,7 @@ void TranslateCommand::initialize(QCliParser &parser)
 		else
 			binTranslate();
 
-		qApp->quit();
+		quit();
 	} catch(QString &s) {
 		xCritical() << s;
 	}
@@ -114,29 +145,47 @@ void TranslateCommand::binTranslate()
 	if(!QFile::exists(_qmake))
 		throw tr("Choosen qmake executable \"%1\" does not exist").arg(_qmake);
 
-	//first: translate the ts file
+	//first: translate the ts file - only if it changed since the last run
 	QFileInfo tsInfo(_tsFile);
 	QString qmFile = _outDir + tsInfo.completeBaseName() + QStringLiteral(".qm");
 	QString qmBaseFile = _outDir + tsInfo.completeBaseName() + QStringLiteral(".qm-base");
+	QString cacheFile = _outDir + tsInfo.completeBaseName() + QStringLiteral(".qm-cache");
 
-	auto args = _lrelease;
-	args.append({_tsFile, QStringLiteral("-qm"), qmBaseFile});
-	execute(args);
+	QByteArrayList cache;
+	QFile cacheIn{cacheFile};
+	if(cacheIn.open(QIODevice::ReadOnly))
+		cache = cacheIn.readAll().split('\n');
+	cacheIn.close();
 
-	//now combine them into one
-	auto locale = localeString();
-	if(locale.isNull()) {
-		QFile::rename(qmBaseFile, qmFile);
-		return;
+	QFile tsIn{_tsFile};
+	if(!tsIn.open(QIODevice::ReadOnly))
+		throw tr("Failed to read %1 with error: %2").arg(_tsFile, tsIn.errorString());
+	QCryptographicHash tsHash{QCryptographicHash::Sha256};
+	tsHash.addData(_lrelease.join(QLatin1Char('\n')).toUtf8());
+	tsHash.addData("\n", 1);
+	tsHash.addData(&tsIn);
+	tsIn.close();
+	auto tsKey = tsHash.result().toHex();
+
+	if(cache.value(0) == tsKey && QFile::exists(qmBaseFile))
+		xDebug() << tr("Translation source \"%1\" is unchanged. Skipping lrelease").arg(_tsFile);
+	else {
+		auto args = _lrelease;
+		args.append({_tsFile, QStringLiteral("-qm"), qmBaseFile});
+		execute(args);
 	}
 
-	args = QStringList {
-		_lconvert,
-		QStringLiteral("-if"), QStringLiteral("qm"),
-		QStringLiteral("-i"), qmBaseFile
-	};
+	QFile baseIn{qmBaseFile};
+	if(!baseIn.open(QIODevice::ReadOnly))
+		throw tr("Failed to read %1 with error: %2").arg(qmBaseFile, baseIn.errorString());
+	auto qmInputs = QList<QByteArray>{baseIn.readAll()};
+	baseIn.close();
+	QStringList qmPaths {qmBaseFile};
 
-	for(const auto &tsDir : qAsConst(_qpmxTsFiles)) {
+	//now combine them into one
+	auto locale = localeString();
+	const auto tsDirs = locale.isNull() ? QStringList{} : _qpmxTsFiles;
+	for(const auto &tsDir : tsDirs) {
 		QDir bDir(tsDir);
 		if(!bDir.exists()) {
 			xWarning() << tr("Translation directory does not exist: %1").arg(tsDir);
@@ -147,14 +196,66 @@ void TranslateCommand::binTranslate()
 		bDir.setNameFilters({QStringLiteral("*.qm")});
 		for(const auto &qpmxQmFile : bDir.entryInfoList()) {
 			auto baseName = qpmxQmFile.completeBaseName();
-			if(baseName.endsWith(locale))
-				args.append({QStringLiteral("-i"), qpmxQmFile.absoluteFilePath()});
+			if(!baseName.endsWith(locale))
+				continue;
+			QFile qmIn{qpmxQmFile.absoluteFilePath()};
+			if(!qmIn.open(QIODevice::ReadOnly))
+				throw tr("Failed to read %1 with error: %2").arg(qmIn.fileName(), qmIn.errorString());
+			qmInputs.append(qmIn.readAll());
+			qmPaths.append(qmIn.fileName());
 		}
 	}
 
-	args.append({QStringLiteral("-of"), QStringLiteral("qm")});
-	args.append({QStringLiteral("-o"), qmFile});
-	execute(args);
+	//the merged file only depends on the inputs
+	QCryptographicHash mergeHash{QCryptographicHash::Sha256};
+	for(auto i = 0; i < qmInputs.size(); i++) {
+		mergeHash.addData(qmPaths[i].toUtf8());
+		mergeHash.addData(QCryptographicHash::hash(qmInputs[i], QCryptographicHash::Sha256));
+	}
+	auto mergeKey = mergeHash.result().toHex();
+	if(cache.value(1) == mergeKey && QFile::exists(qmFile))
+		xDebug() << tr("Translations for \"%1\" are unchanged. Skipping merge").arg(_tsFile);
+	else {
+		try {
+			writeIfChanged(qmFile, mergeQm(qmInputs), false);
+		} catch(QString &s) {
+			xWarning() << tr("Failed to merge qm files in-process: %1. Using lconvert instead").arg(s);
+			QStringList args {
+				_lconvert,
+				QStringLiteral("-if"), QStringLiteral("qm")
+			};
+			for(const auto &qmPath : qAsConst(qmPaths))
+				args.append({QStringLiteral("-i"), qmPath});
+			args.append({QStringLiteral("-of"), QStringLiteral("qm")});
+			args.append({QStringLiteral("-o"), qmFile});
+			execute(args);
+		}
+	}
+
+	writeIfChanged(cacheFile, tsKey + '\n' + mergeKey, false);
+}
+
+QByteArray TranslateCommand::mergeQm(const QList<QByteArray> &qmInputs)
+{
+	if(qmInputs.size() == 1)
+		return qmInputs.first();
+
+	//parsing is independent per file, merging must keep the input order
+	QVector<QmFile> files(qmInputs.size());
+	QVector<QString> errors(qmInputs.size());
+	QThreadPool pool;
+	for(auto i = 0; i < qmInputs.size(); i++)
+		pool.start(new QmParser{qmInputs[i], files[i], errors[i]});
+	pool.waitForDone();
+	for(const auto &error : qAsConst(errors)) {
+		if(!error.isNull())
+			throw error;
+	}
+
+	auto result = files.first();
+	for(auto i = 1; i < files.size(); i++)
+		result.merge(files[i]);
+	return result.save();
 }
 
 void TranslateCommand::srcTranslate()
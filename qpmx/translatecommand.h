@@ -26,6 +26,7 @@ private:
 	QStringList _qpmxTsFiles;
 
 	void binTranslate();
+	QByteArray mergeQm(const QList<QByteArray> &qmInputs);
 	void srcTranslate();
 
 	void execute(QStringList command);
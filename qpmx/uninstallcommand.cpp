@@ -47,7 +47,7 @@ void UninstallCommand::initialize(QCliParser &parser)
 		QpmxFormat::writeDefault(_format);
 
 		xDebug() << tr("Package uninstallation completed");
-		qApp->quit();
+		quit();
 	} catch(QString &s) {
 		xCritical() << s;
 	}
@@ -89,5 +89,6 @@ void UninstallCommand::removePkg(PackageInfo package)
 	if(_cached) {
 		auto _pl = pkgLock(package);
 		cleanCaches(package, _pl);
+		_pl.discard();
 	}
 }
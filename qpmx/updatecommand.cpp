@@ -1,5 +1,6 @@
 #include "updatecommand.h"
-#include <qtcoroutine.h>
+#include <QMap>
+#include <algorithm>
 
 UpdateCommand::UpdateCommand(QObject *parent) :
 	Command{parent}
@@ -40,7 +41,7 @@ void UpdateCommand::initialize(QCliParser &parser)
 		_pkgList = format.dependencies;
 		if(_pkgList.isEmpty()) {
 			xWarning() << tr("No dependencies found in qpmx.json. Nothing will be done");
-			qApp->quit();
+			quit();
 			return;
 		}
 
@@ -53,42 +54,52 @@ void UpdateCommand::initialize(QCliParser &parser)
 
 void UpdateCommand::checkPackages()
 {
-	quint32 currentLoad = 0;
-	QQueue<QtCoroutine::RoutineId> checkQueue;
-	QtCoroutine::awaitEach(_pkgList, [this, &checkQueue, &currentLoad](const QpmxDependency &nextDep){
-		if(currentLoad >= LoadLimit) {
-			checkQueue.enqueue(QtCoroutine::current());
-			QtCoroutine::yield();
-		}
-
-		auto plugin = registry()->sourcePlugin(nextDep.provider);
-		if(!plugin->packageValid(nextDep.pkg())) {
+	QMap<QString, QList<QpmxDependency>> providerDeps;
+	for(const auto &dep : qAsConst(_pkgList)) {
+		auto plugin = registry()->sourcePlugin(dep.provider);
+		if(!plugin->packageValid(dep.pkg())) {
 			throw tr("The package name %1 is not valid for provider %{bld}%2%{end}")
-					.arg(nextDep.package, nextDep.provider);
+					.arg(dep.package, dep.provider);
 		}
+		providerDeps[dep.provider].append(dep);
+	}
 
-		xDebug() << tr("Searching for latest version of %1").arg(nextDep.toString());
-		//use the latest version -> query for it
-		++currentLoad;
-		try {
-			auto version = plugin->findPackageVersion(nextDep.pkg());
-			if(version > nextDep.version)
-				_updateList.append({nextDep, version});
-		} catch (qpmx::SourcePluginException &e) {
-			xWarning() << tr("Failed to fetch latest version of %1 with error: %2").arg(nextDep.toString())
-					   << e.what();
+	//one batched lookup per chunk, with neighbouring package names in the same chunk
+	TaskGroup group{this};
+	for(auto it = providerDeps.begin(); it != providerDeps.end(); it++) {
+		auto plugin = registry()->sourcePlugin(it.key());
+		auto deps = it.value();
+		std::sort(deps.begin(), deps.end(), [](const QpmxDependency &lhs, const QpmxDependency &rhs){
+			return lhs.package < rhs.package;
+		});
+
+		auto chunkCount = qMin(group.providerLimit(), deps.size());
+		auto chunkSize = (deps.size() + chunkCount - 1) / chunkCount;
+		for(auto offset = 0; offset < deps.size(); offset += chunkSize) {
+			auto chunk = deps.mid(offset, chunkSize);
+			group.run(it.key(), [this, plugin, chunk](){
+				QList<qpmx::PackageInfo> packages;
+				packages.reserve(chunk.size());
+				for(const auto &dep : chunk) {
+					xDebug() << tr("Searching for latest version of %1").arg(dep.toString());
+					packages.append(dep.pkg());
+				}
+
+				auto versions = plugin->findPackageVersions(packages);
+				for(auto i = 0; i < chunk.size() && i < versions.size(); i++) {
+					if(versions[i] > chunk[i].version)
+						_updateList.append({chunk[i], versions[i]});
+				}
+			});
 		}
-		--currentLoad;
-
-		if(!checkQueue.isEmpty())
-			QtCoroutine::resume(checkQueue.dequeue());
-	});
+	}
+	group.wait();
 
 	if(!_updateList.isEmpty())
 		completeUpdate();
 	else
 		xInfo() << tr("All packages are up to date");
-	qApp->quit();
+	quit();
 }
 
 void UpdateCommand::completeUpdate()
@@ -3,8 +3,6 @@
 
 #include "command.h"
 
-#include <QQueue>
-
 class UpdateCommand : public Command
 {
 	Q_OBJECT
@@ -20,7 +18,6 @@ protected slots:
 	void initialize(QCliParser &parser) override;
 
 private:
-	static const int LoadLimit = 5;
 	bool _install = false;
 	bool _skipYes = false;
 
@@ -28,7 +25,6 @@ private:
 	QList<QPair<QpmxDependency, QVersionNumber>> _updateList;
 
 	void checkPackages();
-	void checkNext();
 	void completeUpdate();
 };
 